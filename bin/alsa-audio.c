@@ -107,7 +107,8 @@ static void *alsa_audio_start(Host *host)
          return NULL;
 
        {
-        MmmList *l;
+        int ci;
+        int64_t trace_start = mmm_trace_begin ();
         //int16_t temp_audio[81920 * 2];
 
         for (int i = 0; i < c * host_channels; i ++)
@@ -115,9 +116,10 @@ static void *alsa_audio_start(Host *host)
           data[i] = 0;
         }
 
-        for (l = host->clients; l; l = l->next)
+        host_lock_clients (host);
+        for (ci = 0; ci < host->client_count; ci++)
         {
-          Client *client = l->data;
+          Client *client = host->clients[ci];
           float factor = mmm_pcm_get_sample_rate (client->mmm) * 1.0 / host_freq;
           int read = 0;
           int16_t *dst = (void*) data;
@@ -186,6 +188,8 @@ static void *alsa_audio_start(Host *host)
             }
           } while ((read == requested) && remaining > 0);
         }
+        host_unlock_clients (host);
+        mmm_trace_end (trace_start, "mix", NULL);
       }
 /* XXX : can we turn this off when we haven't had writes for a while? to save power if possible? */
       if (got_data)
@@ -0,0 +1,153 @@
+/*
+ * 2014 (c) Øyvind Kolås
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "host-bands.h"
+
+typedef struct _HostBandJob HostBandJob;
+
+struct _HostBandJob
+{
+  HostBandFunc func;
+  void        *data;
+  int          y0;
+  int          y1;
+  int          count;
+};
+
+static pthread_mutex_t band_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  band_start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  band_done  = PTHREAD_COND_INITIALIZER;
+static HostBandJob     band_job;
+static int             band_generation = 0;
+static int             band_pending    = 0;
+static int             band_workers    = 0;
+static int             band_threads    = -1; /* -1 until configured */
+/* the generation each worker was started in, jobs up to it are not theirs */
+static int             band_born[HOST_BANDS_MAX];
+
+static void run_band (int band)
+{
+  int rows = band_job.y1 - band_job.y0;
+  int y0 = band_job.y0 + rows * band / band_job.count;
+  int y1 = band_job.y0 + rows * (band + 1) / band_job.count;
+
+  if (y1 > y0)
+    band_job.func (band_job.data, y0, y1);
+}
+
+static void *band_worker (void *arg)
+{
+  int band = (intptr_t) arg;
+  int generation;
+
+  pthread_mutex_lock (&band_mutex);
+  generation = band_born[band];
+  while (1)
+  {
+    while (generation == band_generation)
+      pthread_cond_wait (&band_start, &band_mutex);
+    generation = band_generation;
+
+    if (band < band_job.count)
+    {
+      pthread_mutex_unlock (&band_mutex);
+      run_band (band);
+      pthread_mutex_lock (&band_mutex);
+      if (--band_pending == 0)
+        pthread_cond_signal (&band_done);
+    }
+  }
+  return NULL;
+}
+
+void host_bands_set_threads (int threads)
+{
+  if (threads < 1)
+    threads = 1;
+  if (threads > HOST_BANDS_MAX)
+    threads = HOST_BANDS_MAX;
+
+  pthread_mutex_lock (&band_mutex);
+  while (band_workers < threads - 1)
+  {
+    pthread_t thread;
+    band_born[band_workers + 1] = band_generation;
+    if (pthread_create (&thread, NULL, band_worker,
+                        (void*)(intptr_t)(band_workers + 1)))
+    {
+      fprintf (stderr, "failed to start band worker\n");
+      break;
+    }
+    pthread_detach (thread);
+    band_workers ++;
+  }
+  band_threads = band_workers + 1 < threads ? band_workers + 1 : threads;
+  pthread_mutex_unlock (&band_mutex);
+}
+
+int host_bands_get_threads (void)
+{
+  if (band_threads < 0)
+  {
+    const char *env = getenv ("MMM_THREADS");
+    host_bands_set_threads (env ? atoi (env) :
+                            (int) sysconf (_SC_NPROCESSORS_ONLN));
+  }
+  return band_threads;
+}
+
+void host_bands_run (HostBandFunc func, void *data,
+                     int y0, int y1, int row_bytes)
+{
+  long bytes = (long)(y1 - y0) * row_bytes;
+  int count = bytes / HOST_BAND_BYTES;
+  int threads = host_bands_get_threads ();
+
+  if (count > threads)
+    count = threads;
+  if (count > y1 - y0)
+    count = y1 - y0;
+
+  if (count <= 1)
+  {
+    if (y1 > y0)
+      func (data, y0, y1);
+    return;
+  }
+
+  pthread_mutex_lock (&band_mutex);
+  band_job.func  = func;
+  band_job.data  = data;
+  band_job.y0    = y0;
+  band_job.y1    = y1;
+  band_job.count = count;
+  band_pending   = count - 1;
+  band_generation ++;
+  pthread_cond_broadcast (&band_start);
+  pthread_mutex_unlock (&band_mutex);
+
+  run_band (0);
+
+  pthread_mutex_lock (&band_mutex);
+  while (band_pending)
+    pthread_cond_wait (&band_done, &band_mutex);
+  pthread_mutex_unlock (&band_mutex);
+}
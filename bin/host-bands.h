@@ -0,0 +1,44 @@
+/*
+ * 2014 (c) Øyvind Kolås
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#ifndef HOST_BANDS_H
+#define HOST_BANDS_H
+
+/* A small pool of worker threads for moving pixels; a range of rows is split
+ * into horizontal bands that are processed in parallel, with the calling
+ * thread doing the first band.  Ranges of less than HOST_BAND_BYTES per band
+ * are not worth waking the workers for and are done on the calling thread.
+ *
+ * The number of threads defaults to the number of online cpus, and can be
+ * set with the MMM_THREADS environment variable, MMM_THREADS=1 disables the
+ * pool.
+ */
+
+#define HOST_BANDS_MAX  16
+#define HOST_BAND_BYTES (256 * 1024)
+
+typedef void (*HostBandFunc) (void *data, int y0, int y1);
+
+/* call func for all rows in y0 - y1, with row_bytes being the amount of
+ * memory written per row, returns when all bands are done.
+ */
+void host_bands_run         (HostBandFunc func, void *data,
+                             int y0, int y1, int row_bytes);
+
+/* change the number of threads used, including the caller */
+void host_bands_set_threads (int threads);
+int  host_bands_get_threads (void);
+
+#endif
@@ -0,0 +1,166 @@
+/*
+ * 2014 (c) Øyvind Kolås
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+/* measures how full frame pixel moves of the hosts scale with the number of
+ * band threads, and what dithering costs over truncating conversion to the
+ * fbdev pixel formats:
+ *
+ *   mmm-bench [width height [max-threads]]
+ */
+
+#include "mmm.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "host-bands.h"
+#include "host-convert.h"
+
+#define ITERATIONS 20
+
+typedef struct _Frame Frame;
+
+struct _Frame
+{
+  const uint8_t     *src;
+  uint8_t           *dst;
+  int                width;
+  const HostConvert *convert; /* NULL for a plain copy */
+};
+
+/* the rows as copy_rows of host-composite moves them into client caches */
+static void convert_rows (void *data, int y0, int y1)
+{
+  Frame *frame = data;
+  int scan;
+
+  for (scan = y0; scan < y1; scan++)
+  {
+    const uint8_t *src = frame->src + scan * frame->width * 4;
+    uint8_t *dst = frame->dst + scan * frame->width * 4;
+
+    if (frame->convert)
+      host_convert_row (frame->convert, dst, src, 0, scan, frame->width);
+    else
+      memcpy (dst, src, frame->width * 4);
+  }
+}
+
+static double run_convert (const uint8_t *src, uint8_t *dst,
+                           int width, int height,
+                           int bits, int grayscale, int dither)
+{
+  HostConvert convert;
+  long start;
+  int i, y;
+
+  setenv ("MMM_DITHER", dither ? "1" : "0", 1);
+  host_convert_init (&convert, bits, grayscale, grayscale ? 4 : 8);
+
+  start = mmm_ticks ();
+  for (i = 0; i < ITERATIONS; i++)
+    for (y = 0; y < height; y++)
+      host_convert_row (&convert, dst + y * width * 4, src + y * width * 4,
+                        0, y, width);
+  return (mmm_ticks () - start) / 1000.0 / ITERATIONS;
+}
+
+static double run (Frame *frame, int height, int threads)
+{
+  long start;
+  int i;
+
+  host_bands_set_threads (threads);
+  host_bands_run (convert_rows, frame, 0, height, frame->width * 4);
+
+  start = mmm_ticks ();
+  for (i = 0; i < ITERATIONS; i++)
+    host_bands_run (convert_rows, frame, 0, height, frame->width * 4);
+  return (mmm_ticks () - start) / 1000.0 / ITERATIONS;
+}
+
+int main (int argc, char **argv)
+{
+  int width = 3840;
+  int height = 2160;
+  int max_threads = host_bands_get_threads ();
+  double base[2];
+  uint8_t *src, *dst;
+  HostConvert convert;
+  Frame frame;
+  int threads;
+  int i;
+
+  if (argc >= 3)
+  {
+    width = atoi (argv[1]);
+    height = atoi (argv[2]);
+  }
+  if (argc >= 4)
+    max_threads = atoi (argv[3]);
+  if (max_threads > HOST_BANDS_MAX)
+    max_threads = HOST_BANDS_MAX;
+
+  src = malloc (width * height * 4);
+  dst = malloc (width * height * 4);
+  if (!src || !dst || width <= 0 || height <= 0)
+  {
+    fprintf (stderr, "failed to allocate %ix%i frames\n", width, height);
+    return -1;
+  }
+  for (i = 0; i < width * height * 4; i++)
+    src[i] = i * 7;
+
+  frame.src = src;
+  frame.dst = dst;
+  frame.width = width;
+  /* 565 as the fbdev host converts it, dithered unless MMM_DITHER=0 */
+  host_convert_init (&convert, 16, 0, 8);
+
+  printf ("%ix%i, %i iterations\n", width, height, ITERATIONS);
+  printf ("threads  convert ms  speedup   copy ms  speedup\n");
+  for (threads = 1; threads <= max_threads; threads++)
+  {
+    double ms[2];
+    for (i = 0; i < 2; i++)
+    {
+      frame.convert = i ? NULL : &convert;
+      ms[i] = run (&frame, height, threads);
+      if (threads == 1)
+        base[i] = ms[i];
+    }
+    printf ("%7i  %10.2f  %6.2fx  %8.2f  %6.2fx\n", threads,
+            ms[0], base[0] / ms[0], ms[1], base[1] / ms[1]);
+  }
+
+  printf ("\nsingle thread conversion\n");
+  printf ("format   truncate ms  dither ms\n");
+  {
+    static const struct { const char *name; int bits; int grayscale; }
+      formats[] = {{"565", 16, 0}, {"555", 15, 0}, {"332", 8, 0},
+                   {"gray4", 8, 1}};
+    for (i = 0; i < 4; i++)
+      printf ("%-6s  %12.2f  %9.2f\n", formats[i].name,
+        run_convert (src, dst, width, height,
+                     formats[i].bits, formats[i].grayscale, 0),
+        run_convert (src, dst, width, height,
+                     formats[i].bits, formats[i].grayscale, 1));
+  }
+
+  free (src);
+  free (dst);
+  return 0;
+}
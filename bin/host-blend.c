@@ -0,0 +1,127 @@
+/*
+ * 2014 (c) Øyvind Kolås
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define HOST_BLEND_NEON 1
+#endif
+
+#include "host-blend.h"
+
+/* x * (255 - a) / 255, rounded */
+static inline uint8_t scale_inverse (uint8_t x, uint8_t a)
+{
+  int t = x * (255 - a) + 128;
+  return (t + (t >> 8)) >> 8;
+}
+
+static inline void blend_pixel (uint8_t *dst, const uint8_t *src)
+{
+  uint8_t a = src[3];
+  int c;
+
+  if (a == 255)
+  {
+    memcpy (dst, src, 4);
+    return;
+  }
+  for (c = 0; c < 4; c++)
+  {
+    int v = src[c] + scale_inverse (dst[c], a);
+    dst[c] = v > 255 ? 255 : v;
+  }
+}
+
+void host_blend_over (uint8_t *dst, const uint8_t *src, int count)
+{
+#if defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128 ();
+  const __m128i all  = _mm_set1_epi8 ((char)0xff);
+  const __m128i mask = _mm_set1_epi32 ((int)0xff000000);
+  const __m128i bias = _mm_set1_epi16 (128);
+  const __m128i ff   = _mm_set1_epi16 (255);
+
+  for (; count >= 4; count -= 4, dst += 16, src += 16)
+  {
+    __m128i s = _mm_loadu_si128 ((const __m128i*)src);
+    __m128i alpha = _mm_and_si128 (s, mask);
+    __m128i d, lo, hi, ia;
+
+    /* runs of fully transparent or fully opaque pixels are common */
+    if (_mm_movemask_epi8 (_mm_cmpeq_epi8 (s, zero)) == 0xffff)
+      continue;
+    if (_mm_movemask_epi8 (_mm_cmpeq_epi8 (_mm_or_si128 (alpha,
+                             _mm_andnot_si128 (mask, all)), all)) == 0xffff)
+    {
+      _mm_storeu_si128 ((__m128i*)dst, s);
+      continue;
+    }
+
+    d = _mm_loadu_si128 ((const __m128i*)dst);
+
+    lo = _mm_unpacklo_epi8 (s, zero);
+    ia = _mm_shufflehi_epi16 (_mm_shufflelo_epi16 (lo, 0xff), 0xff);
+    ia = _mm_sub_epi16 (ff, ia);
+    lo = _mm_add_epi16 (_mm_mullo_epi16 (_mm_unpacklo_epi8 (d, zero), ia), bias);
+    lo = _mm_srli_epi16 (_mm_add_epi16 (lo, _mm_srli_epi16 (lo, 8)), 8);
+
+    hi = _mm_unpackhi_epi8 (s, zero);
+    ia = _mm_shufflehi_epi16 (_mm_shufflelo_epi16 (hi, 0xff), 0xff);
+    ia = _mm_sub_epi16 (ff, ia);
+    hi = _mm_add_epi16 (_mm_mullo_epi16 (_mm_unpackhi_epi8 (d, zero), ia), bias);
+    hi = _mm_srli_epi16 (_mm_add_epi16 (hi, _mm_srli_epi16 (hi, 8)), 8);
+
+    _mm_storeu_si128 ((__m128i*)dst,
+                      _mm_adds_epu8 (s, _mm_packus_epi16 (lo, hi)));
+  }
+#elif HOST_BLEND_NEON
+  for (; count >= 8; count -= 8, dst += 32, src += 32)
+  {
+    uint8x8x4_t s = vld4_u8 (src);
+    uint8x8x4_t d;
+    uint8x8_t ia;
+    uint8x8_t any = vorr_u8 (vorr_u8 (s.val[0], s.val[1]),
+                             vorr_u8 (s.val[2], s.val[3]));
+    int c;
+
+    /* runs of fully transparent or fully opaque pixels are common */
+    if (vget_lane_u64 (vreinterpret_u64_u8 (any), 0) == 0)
+      continue;
+    if (vget_lane_u64 (vreinterpret_u64_u8 (s.val[3]), 0) == ~(uint64_t)0)
+    {
+      vst4_u8 (dst, s);
+      continue;
+    }
+
+    d = vld4_u8 (dst);
+    ia = vmvn_u8 (s.val[3]);
+    for (c = 0; c < 4; c++)
+    {
+      uint16x8_t t = vmull_u8 (d.val[c], ia);
+      d.val[c] = vqadd_u8 (s.val[c], vraddhn_u16 (t, vrshrq_n_u16 (t, 8)));
+    }
+    vst4_u8 (dst, d);
+  }
+#endif
+
+  for (; count > 0; count--, dst += 4, src += 4)
+    if (src[3] || src[0] || src[1] || src[2])
+      blend_pixel (dst, src);
+}
@@ -0,0 +1,213 @@
+/*
+ * 2014 (c) Øyvind Kolås
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "mmm.h"
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "host.h"
+#include "host-composite.h"
+#include "host-bands.h"
+#include "host-trace.h"
+#include "host-stats.h"
+
+typedef struct _CopyRows CopyRows;
+
+struct _CopyRows
+{
+  Host          *host;
+  const uint8_t *src;
+  int            src_stride;
+  uint8_t       *dst;
+  int            dst_stride;
+  int            x;
+  int            y;
+  int            width;
+};
+
+static void copy_rows (void *data, int y0, int y1)
+{
+  CopyRows *rows = data;
+  const uint8_t *src = rows->src + y0 * rows->src_stride;
+  uint8_t *dst = rows->dst + y0 * rows->dst_stride;
+  int scan;
+
+  for (scan = y0; scan < y1; scan++)
+  {
+    if (rows->host->cache_convert)
+      rows->host->cache_convert (rows->host, dst, src,
+                                 rows->x, rows->y + scan, rows->width);
+    else
+      memcpy (dst, src, rows->width * 4);
+    src += rows->src_stride;
+    dst += rows->dst_stride;
+  }
+}
+
+static void copy_rect (Host *host, Client *client,
+                       const uint8_t *pixels, int stride,
+                       int x, int y, int width, int height)
+{
+  int bpp = host->cache_bpp ? host->cache_bpp : 4;
+  CopyRows rows;
+
+  if (x < 0) { width += x; x = 0; }
+  if (y < 0) { height += y; y = 0; }
+  if (x + width > client->cache_width)   width = client->cache_width - x;
+  if (y + height > client->cache_height) height = client->cache_height - y;
+  if (width <= 0 || height <= 0)
+    return;
+
+  rows.host = host;
+  rows.src = pixels + y * stride + x * 4;
+  rows.src_stride = stride;
+  rows.dst = client->cache + y * client->cache_stride + x * bpp;
+  rows.dst_stride = client->cache_stride;
+  rows.x = x;
+  rows.y = y;
+  rows.width = width;
+  host_bands_run (copy_rows, &rows, 0, height, width * bpp);
+}
+
+void host_move_rect (uint8_t *pixels, int stride, int bpp,
+                     const MmmRectangle *rect, int dx, int dy)
+{
+  int scan = dy > 0 ? rect->height - 1 : 0;
+  int step = dy > 0 ? -1 : 1;
+
+  for (; scan >= 0 && scan < rect->height; scan += step)
+    memmove (pixels + (rect->y + dy + scan) * stride + (rect->x + dx) * bpp,
+             pixels + (rect->y + scan) * stride + rect->x * bpp,
+             rect->width * bpp);
+}
+
+int host_client_move (Host *host, Client *client,
+                      const MmmRectangle *rect, int dx, int dy)
+{
+  int bpp = host->cache_bpp ? host->cache_bpp : 4;
+
+  if (!client->cache || client->cache_stale ||
+      rect->x < 0 || rect->y < 0 || rect->x + dx < 0 || rect->y + dy < 0 ||
+      rect->x + rect->width > client->cache_width ||
+      rect->y + rect->height > client->cache_height ||
+      rect->x + dx + rect->width > client->cache_width ||
+      rect->y + dy + rect->height > client->cache_height)
+    return 0;
+
+  /* with dithering the moved pixels keep the pattern of where they were */
+  host_move_rect (client->cache, client->cache_stride, bpp, rect, dx, dy);
+  host_stats_bytes ((long)rect->width * rect->height * bpp);
+  return 1;
+}
+
+const uint8_t *host_client_read (Host *host, Client *client,
+                                 int *width, int *height, int *stride)
+{
+  const uint8_t *pixels;
+  int damage_x, damage_y, damage_width, damage_height;
+  int client_width, client_height, client_stride;
+  int64_t trace_start;
+  long start;
+
+  /* nothing new, and the copy is still of the right size */
+  if (client->cache && !client->cache_stale &&
+      client->cache_width == mmm_get_width (client->mmm) &&
+      client->cache_height == mmm_get_height (client->mmm) &&
+      !mmm_get_damage (client->mmm, NULL, NULL, NULL, NULL))
+    goto done;
+
+  start = mmm_ticks ();
+  pixels = mmm_get_buffer_read_nowait (client->mmm, &client_width,
+                                       &client_height, &client_stride);
+  if (!pixels)
+  {
+    /* drawing, or stuck drawing - use what we have, the new frame is
+     * picked up when it gets committed
+     */
+    client->stalls++;
+    mmm_trace_mark ("stall", mmm_get_title (client->mmm));
+    host_stats_add (HOST_STAT_READ, mmm_ticks () - start);
+    goto done;
+  }
+
+  trace_start = mmm_trace_begin ();
+  mmm_get_damage (client->mmm, &damage_x, &damage_y,
+                  &damage_width, &damage_height);
+
+  if (!client->cache ||
+      client->cache_width != client_width ||
+      client->cache_height != client_height)
+  {
+    free (client->cache);
+    client->cache_width  = client_width;
+    client->cache_height = client_height;
+    client->cache_stride = client_width * (host->cache_bpp ? host->cache_bpp : 4);
+    client->cache = malloc (client->cache_stride * client_height + 1);
+    client->cache_stale = 1;
+  }
+
+  /* pixels the client moved before drawing the damage are moved here too,
+   * unless that was done as the frame was announced
+   */
+  if (!client->cache_stale && !client->copy_applied &&
+      damage_width > 0 && damage_height > 0)
+  {
+    MmmRectangle copy;
+    int dx, dy;
+
+    if (mmm_get_copy (client->mmm, &copy, &dx, &dy) &&
+        !host_client_move (host, client, &copy, dx, dy))
+      client->cache_stale = 1;
+  }
+
+  if (client->cache_stale || damage_width <= 0 || damage_height <= 0)
+    copy_rect (host, client, pixels, client_stride, 0, 0,
+               client_width, client_height);
+  else
+    copy_rect (host, client, pixels, client_stride, damage_x, damage_y,
+               damage_width, damage_height);
+  client->cache_stale = 0;
+
+  host_trace_frame (client);
+  mmm_read_done (client->mmm);
+  client->copy_applied = 0;
+  mmm_trace_end (trace_start, "read", mmm_get_title (client->mmm));
+  host_stats_add (HOST_STAT_READ, mmm_ticks () - start);
+
+done:
+  if (width)  *width  = client->cache_width;
+  if (height) *height = client->cache_height;
+  if (stride) *stride = client->cache_stride;
+  return client->cache;
+}
+
+void host_client_skip (Host *host, Client *client)
+{
+  if (mmm_get_damage (client->mmm, NULL, NULL, NULL, NULL))
+  {
+    /* the frame is never shown, neither is a response to input in it */
+    mmm_get_frame_input (client->mmm, NULL, NULL);
+    mmm_read_done (client->mmm);
+    client->copy_applied = 0;
+    client->cache_stale = 1;
+  }
+}
+
+void host_client_free_cache (Client *client)
+{
+  free (client->cache);
+  client->cache = NULL;
+}
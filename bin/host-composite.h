@@ -0,0 +1,52 @@
+/*
+ * 2014 (c) Øyvind Kolås
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#ifndef HOST_COMPOSITE_H
+#define HOST_COMPOSITE_H
+
+#include <stdint.h>
+
+/* The host keeps a copy of the last content it read from each client, in
+ * its native pixel format, and composites from that - letting it redraw a
+ * client without waiting for it or converting pixels again, the copy is
+ * brought up to date from the damage of the client when it is ready to be
+ * read.
+ */
+
+/* returns the up to date content of client, or its last known content if
+ * the client is busy - NULL if nothing has been read from it yet.
+ */
+const uint8_t *host_client_read (Host *host, Client *client,
+                                 int *width, int *height, int *stride);
+
+/* moves the rect of the cache of a client by dx, dy in client coordinates,
+ * applying a copy the client made - returns 0 if the cache is not up to
+ * date or the copy is out of bounds.
+ */
+int host_client_move (Host *host, Client *client,
+                      const MmmRectangle *rect, int dx, int dy);
+
+/* moves the pixels of rect by dx, dy within a buffer */
+void host_move_rect (uint8_t *pixels, int stride, int bpp,
+                     const MmmRectangle *rect, int dx, int dy);
+
+/* acknowledges a new frame from an occluded client without copying it,
+ * the whole buffer is read again once it is visible.
+ */
+void host_client_skip (Host *host, Client *client);
+
+void host_client_free_cache (Client *client);
+
+#endif
@@ -0,0 +1,379 @@
+/*
+ * 2014 (c) Øyvind Kolås
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define HOST_CONVERT_NEON 1
+#endif
+
+#include "host-convert.h"
+
+static const uint8_t bayer[8][8] = {
+  {  0, 32,  8, 40,  2, 34, 10, 42 },
+  { 48, 16, 56, 24, 50, 18, 58, 26 },
+  { 12, 44,  4, 36, 14, 46,  6, 38 },
+  { 60, 28, 52, 20, 62, 30, 54, 22 },
+  {  3, 35, 11, 43,  1, 33,  9, 41 },
+  { 51, 19, 59, 27, 49, 17, 57, 25 },
+  { 15, 47,  7, 39, 13, 45,  5, 37 },
+  { 63, 31, 55, 23, 61, 29, 53, 21 }
+};
+
+void host_convert_init (HostConvert *convert, int bits,
+                        int grayscale, int gray_bits)
+{
+  const char *env = getenv ("MMM_DITHER");
+  int shift[3] = {0, 0, 0};
+  int row, px, c;
+
+  memset (convert, 0, sizeof (HostConvert));
+  convert->bits = bits;
+  convert->grayscale = grayscale && bits == 8;
+  convert->gray_bits = gray_bits == 4 ? 4 : 8;
+  convert->dither = !(env && !strcmp (env, "0"));
+
+  if (convert->grayscale)
+    shift[0] = 8 - convert->gray_bits;
+  else switch (bits)
+  {
+    case 16: shift[0] = 3; shift[1] = 2; shift[2] = 3; break;
+    case 15: shift[0] = 3; shift[1] = 3; shift[2] = 3; break;
+    case 8:  shift[0] = 5; shift[1] = 5; shift[2] = 6; break;
+  }
+  if (!convert->dither)
+    return;
+
+  /* the thresholds scaled to the quantization step of each component,
+   * laid out like the pixels they are added to and repeated so that a
+   * full vector can be loaded starting at any phase of the tile
+   */
+  for (row = 0; row < 8; row++)
+    for (px = 0; px < 32; px++)
+    {
+      int t = bayer[row][px & 7];
+      if (convert->grayscale)
+      {
+        convert->bias[row][px] = (t << shift[0]) >> 6;
+        continue;
+      }
+      for (c = 0; c < 3; c++)
+        convert->bias[row][px * 4 + c] = (t << shift[c]) >> 6;
+    }
+}
+
+static inline int adds (int a, int b)
+{
+  a += b;
+  return a > 255 ? 255 : a;
+}
+
+static inline int luminance (const uint8_t *src)
+{
+  return (src[0] * 38 + src[1] * 75 + src[2] * 15 + 64) >> 7;
+}
+
+static void convert_565 (uint8_t *dst, const uint8_t *src,
+                         const uint8_t *bias, int x, int count)
+{
+  int i = 0;
+#if defined(__SSE2__)
+  const __m128i mr = _mm_set1_epi32 (0xf8);
+  const __m128i mg = _mm_set1_epi32 (0xfc00);
+  const __m128i mb = _mm_set1_epi32 (0xf80000);
+  const __m128i sign = _mm_set1_epi32 (0x8000);
+  const __m128i sign16 = _mm_set1_epi16 ((short)0x8000);
+
+  for (; i + 8 <= count; i += 8)
+  {
+    const uint8_t *b = bias + ((x + i) & 7) * 4;
+    __m128i p0 = _mm_loadu_si128 ((const __m128i*)(src + i * 4));
+    __m128i p1 = _mm_loadu_si128 ((const __m128i*)(src + i * 4 + 16));
+    __m128i v0, v1;
+
+    p0 = _mm_adds_epu8 (p0, _mm_loadu_si128 ((const __m128i*)b));
+    p1 = _mm_adds_epu8 (p1, _mm_loadu_si128 ((const __m128i*)(b + 16)));
+    v0 = _mm_or_si128 (_mm_or_si128 (
+           _mm_srli_epi32 (_mm_and_si128 (p0, mr), 3),
+           _mm_srli_epi32 (_mm_and_si128 (p0, mg), 5)),
+           _mm_srli_epi32 (_mm_and_si128 (p0, mb), 8));
+    v1 = _mm_or_si128 (_mm_or_si128 (
+           _mm_srli_epi32 (_mm_and_si128 (p1, mr), 3),
+           _mm_srli_epi32 (_mm_and_si128 (p1, mg), 5)),
+           _mm_srli_epi32 (_mm_and_si128 (p1, mb), 8));
+    /* SSE2 only has a signed 32 to 16bit pack, bias into its range */
+    v0 = _mm_packs_epi32 (_mm_sub_epi32 (v0, sign), _mm_sub_epi32 (v1, sign));
+    _mm_storeu_si128 ((__m128i*)(dst + i * 2), _mm_xor_si128 (v0, sign16));
+  }
+#elif HOST_CONVERT_NEON
+  for (; i + 16 <= count; i += 16)
+  {
+    uint8x16x4_t p = vld4q_u8 (src + i * 4);
+    uint8x16x4_t b = vld4q_u8 (bias + ((x + i) & 7) * 4);
+    uint8x16_t r = vqaddq_u8 (p.val[0], b.val[0]);
+    uint8x16_t g = vqaddq_u8 (p.val[1], b.val[1]);
+    uint8x16_t bl = vqaddq_u8 (p.val[2], b.val[2]);
+    uint16x8_t lo, hi;
+
+    lo = vshll_n_u8 (vget_low_u8 (bl), 8);
+    lo = vsriq_n_u16 (lo, vshll_n_u8 (vget_low_u8 (g), 8), 5);
+    lo = vsriq_n_u16 (lo, vshll_n_u8 (vget_low_u8 (r), 8), 11);
+    hi = vshll_n_u8 (vget_high_u8 (bl), 8);
+    hi = vsriq_n_u16 (hi, vshll_n_u8 (vget_high_u8 (g), 8), 5);
+    hi = vsriq_n_u16 (hi, vshll_n_u8 (vget_high_u8 (r), 8), 11);
+    vst1q_u16 ((uint16_t*)(dst + i * 2), lo);
+    vst1q_u16 ((uint16_t*)(dst + i * 2 + 16), hi);
+  }
+#endif
+  for (; i < count; i++)
+  {
+    const uint8_t *b = bias + ((x + i) & 7) * 4;
+    const uint8_t *s = src + i * 4;
+    int big = ((adds (s[0], b[0]) >> 3)) +
+              ((adds (s[1], b[1]) >> 2)<<5) +
+              ((adds (s[2], b[2]) >> 3)<<11);
+    dst[i * 2 + 1] = big >> 8;
+    dst[i * 2 + 0] = big & 255;
+  }
+}
+
+static void convert_555 (uint8_t *dst, const uint8_t *src,
+                         const uint8_t *bias, int x, int count)
+{
+  int i = 0;
+#if defined(__SSE2__)
+  const __m128i mr = _mm_set1_epi32 (0xf8);
+  const __m128i mg = _mm_set1_epi32 (0xf800);
+  const __m128i mb = _mm_set1_epi32 (0xf80000);
+
+  for (; i + 8 <= count; i += 8)
+  {
+    const uint8_t *b = bias + ((x + i) & 7) * 4;
+    __m128i p0 = _mm_loadu_si128 ((const __m128i*)(src + i * 4));
+    __m128i p1 = _mm_loadu_si128 ((const __m128i*)(src + i * 4 + 16));
+    __m128i v0, v1;
+
+    p0 = _mm_adds_epu8 (p0, _mm_loadu_si128 ((const __m128i*)b));
+    p1 = _mm_adds_epu8 (p1, _mm_loadu_si128 ((const __m128i*)(b + 16)));
+    v0 = _mm_or_si128 (_mm_or_si128 (
+           _mm_slli_epi32 (_mm_and_si128 (p0, mr), 7),
+           _mm_srli_epi32 (_mm_and_si128 (p0, mg), 6)),
+           _mm_srli_epi32 (_mm_and_si128 (p0, mb), 19));
+    v1 = _mm_or_si128 (_mm_or_si128 (
+           _mm_slli_epi32 (_mm_and_si128 (p1, mr), 7),
+           _mm_srli_epi32 (_mm_and_si128 (p1, mg), 6)),
+           _mm_srli_epi32 (_mm_and_si128 (p1, mb), 19));
+    /* 15bit values fit the signed pack */
+    _mm_storeu_si128 ((__m128i*)(dst + i * 2), _mm_packs_epi32 (v0, v1));
+  }
+#elif HOST_CONVERT_NEON
+  for (; i + 16 <= count; i += 16)
+  {
+    uint8x16x4_t p = vld4q_u8 (src + i * 4);
+    uint8x16x4_t b = vld4q_u8 (bias + ((x + i) & 7) * 4);
+    uint8x16_t r = vqaddq_u8 (p.val[0], b.val[0]);
+    uint8x16_t g = vqaddq_u8 (p.val[1], b.val[1]);
+    uint8x16_t bl = vqaddq_u8 (p.val[2], b.val[2]);
+    uint16x8_t lo, hi;
+
+    lo = vshrq_n_u16 (vshll_n_u8 (vget_low_u8 (r), 8), 1);
+    lo = vsriq_n_u16 (lo, vshll_n_u8 (vget_low_u8 (g), 8), 6);
+    lo = vsriq_n_u16 (lo, vshll_n_u8 (vget_low_u8 (bl), 8), 11);
+    hi = vshrq_n_u16 (vshll_n_u8 (vget_high_u8 (r), 8), 1);
+    hi = vsriq_n_u16 (hi, vshll_n_u8 (vget_high_u8 (g), 8), 6);
+    hi = vsriq_n_u16 (hi, vshll_n_u8 (vget_high_u8 (bl), 8), 11);
+    vst1q_u16 ((uint16_t*)(dst + i * 2), lo);
+    vst1q_u16 ((uint16_t*)(dst + i * 2 + 16), hi);
+  }
+#endif
+  for (; i < count; i++)
+  {
+    const uint8_t *b = bias + ((x + i) & 7) * 4;
+    const uint8_t *s = src + i * 4;
+    int big = ((adds (s[2], b[2]) >> 3)) +
+              ((adds (s[1], b[1]) >> 3)<<5) +
+              ((adds (s[0], b[0]) >> 3)<<10);
+    dst[i * 2 + 1] = big >> 8;
+    dst[i * 2 + 0] = big & 255;
+  }
+}
+
+static void convert_332 (uint8_t *dst, const uint8_t *src,
+                         const uint8_t *bias, int x, int count)
+{
+  int i = 0;
+#if defined(__SSE2__)
+  const __m128i mr = _mm_set1_epi32 (0xe0);
+  const __m128i mg = _mm_set1_epi32 (0xe000);
+  const __m128i mb = _mm_set1_epi32 (0xc00000);
+
+  for (; i + 8 <= count; i += 8)
+  {
+    const uint8_t *b = bias + ((x + i) & 7) * 4;
+    __m128i p0 = _mm_loadu_si128 ((const __m128i*)(src + i * 4));
+    __m128i p1 = _mm_loadu_si128 ((const __m128i*)(src + i * 4 + 16));
+    __m128i v0, v1;
+
+    p0 = _mm_adds_epu8 (p0, _mm_loadu_si128 ((const __m128i*)b));
+    p1 = _mm_adds_epu8 (p1, _mm_loadu_si128 ((const __m128i*)(b + 16)));
+    v0 = _mm_or_si128 (_mm_or_si128 (
+           _mm_srli_epi32 (_mm_and_si128 (p0, mr), 5),
+           _mm_srli_epi32 (_mm_and_si128 (p0, mg), 10)),
+           _mm_srli_epi32 (_mm_and_si128 (p0, mb), 16));
+    v1 = _mm_or_si128 (_mm_or_si128 (
+           _mm_srli_epi32 (_mm_and_si128 (p1, mr), 5),
+           _mm_srli_epi32 (_mm_and_si128 (p1, mg), 10)),
+           _mm_srli_epi32 (_mm_and_si128 (p1, mb), 16));
+    v0 = _mm_packs_epi32 (v0, v1);
+    _mm_storel_epi64 ((__m128i*)(dst + i), _mm_packus_epi16 (v0, v0));
+  }
+#elif HOST_CONVERT_NEON
+  for (; i + 16 <= count; i += 16)
+  {
+    uint8x16x4_t p = vld4q_u8 (src + i * 4);
+    uint8x16x4_t b = vld4q_u8 (bias + ((x + i) & 7) * 4);
+    uint8x16_t v;
+
+    v = vandq_u8 (vqaddq_u8 (p.val[2], b.val[2]), vdupq_n_u8 (0xc0));
+    v = vsriq_n_u8 (v, vqaddq_u8 (p.val[1], b.val[1]), 2);
+    v = vsriq_n_u8 (v, vqaddq_u8 (p.val[0], b.val[0]), 5);
+    vst1q_u8 (dst + i, v);
+  }
+#endif
+  for (; i < count; i++)
+  {
+    const uint8_t *b = bias + ((x + i) & 7) * 4;
+    const uint8_t *s = src + i * 4;
+    dst[i] = ((adds (s[0], b[0]) >> 5)) +
+             ((adds (s[1], b[1]) >> 5)<<3) +
+             ((adds (s[2], b[2]) >> 6)<<6);
+  }
+}
+
+/* luminance, dithered down to 16 levels when gray_bits is 4; the levels
+ * are spread over the full byte range as eink controllers expect
+ */
+static void convert_gray (uint8_t *dst, const uint8_t *src,
+                          const uint8_t *bias, int x, int count,
+                          int gray_bits)
+{
+  int i = 0;
+#if defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128 ();
+  const __m128i coeff = _mm_set_epi16 (0, 15, 75, 38, 0, 15, 75, 38);
+  const __m128i one = _mm_set1_epi16 (1);
+  const __m128i round = _mm_set1_epi32 (64);
+  const __m128i high = _mm_set1_epi8 ((char)0xf0);
+  const __m128i low = _mm_set1_epi8 (0x0f);
+
+  for (; i + 16 <= count; i += 16)
+  {
+    __m128i y[4], v;
+    int j;
+
+    for (j = 0; j < 4; j++)
+    {
+      __m128i p = _mm_loadu_si128 ((const __m128i*)(src + (i + j * 4) * 4));
+      /* two rounds of multiply-add, the first gives r+g and b per pixel,
+       * with weights summing to 128 so the partial sums stay signed 16bit
+       */
+      __m128i lo = _mm_madd_epi16 (_mm_unpacklo_epi8 (p, zero), coeff);
+      __m128i hi = _mm_madd_epi16 (_mm_unpackhi_epi8 (p, zero), coeff);
+      y[j] = _mm_madd_epi16 (_mm_packs_epi32 (lo, hi), one);
+      y[j] = _mm_srli_epi32 (_mm_add_epi32 (y[j], round), 7);
+    }
+    v = _mm_packus_epi16 (_mm_packs_epi32 (y[0], y[1]),
+                          _mm_packs_epi32 (y[2], y[3]));
+    if (gray_bits == 4)
+    {
+      v = _mm_adds_epu8 (v, _mm_loadu_si128 ((const __m128i*)
+                                             (bias + ((x + i) & 7))));
+      v = _mm_and_si128 (v, high);
+      v = _mm_or_si128 (v, _mm_and_si128 (_mm_srli_epi16 (v, 4), low));
+    }
+    _mm_storeu_si128 ((__m128i*)(dst + i), v);
+  }
+#elif HOST_CONVERT_NEON
+  for (; i + 16 <= count; i += 16)
+  {
+    uint8x16x4_t p = vld4q_u8 (src + i * 4);
+    uint16x8_t lo, hi;
+    uint8x16_t v;
+
+    lo = vmull_u8 (vget_low_u8 (p.val[0]), vdup_n_u8 (38));
+    lo = vmlal_u8 (lo, vget_low_u8 (p.val[1]), vdup_n_u8 (75));
+    lo = vmlal_u8 (lo, vget_low_u8 (p.val[2]), vdup_n_u8 (15));
+    hi = vmull_u8 (vget_high_u8 (p.val[0]), vdup_n_u8 (38));
+    hi = vmlal_u8 (hi, vget_high_u8 (p.val[1]), vdup_n_u8 (75));
+    hi = vmlal_u8 (hi, vget_high_u8 (p.val[2]), vdup_n_u8 (15));
+    v = vcombine_u8 (vrshrn_n_u16 (lo, 7), vrshrn_n_u16 (hi, 7));
+    if (gray_bits == 4)
+    {
+      v = vqaddq_u8 (v, vld1q_u8 (bias + ((x + i) & 7)));
+      v = vandq_u8 (v, vdupq_n_u8 (0xf0));
+      v = vsriq_n_u8 (v, v, 4);
+    }
+    vst1q_u8 (dst + i, v);
+  }
+#endif
+  for (; i < count; i++)
+  {
+    int v = luminance (src + i * 4);
+    if (gray_bits == 4)
+    {
+      v = adds (v, bias[(x + i) & 7]) & 0xf0;
+      v |= v >> 4;
+    }
+    dst[i] = v;
+  }
+}
+
+static void convert_888 (uint8_t *dst, const uint8_t *src, int count)
+{
+  while (count--)
+    {
+      dst[0] = src[0];
+      dst[1] = src[1];
+      dst[2] = src[2];
+      dst+=3;
+      src+=4;
+    }
+}
+
+void host_convert_row (const HostConvert *convert,
+                       uint8_t *dst, const uint8_t *src,
+                       int x, int y, int count)
+{
+  const uint8_t *bias = convert->bias[y & 7];
+
+  if (convert->grayscale)
+  {
+    convert_gray (dst, src, bias, x, count, convert->gray_bits);
+    return;
+  }
+  switch (convert->bits)
+  {
+    case 32: memcpy (dst, src, count * 4); break;
+    case 24: convert_888 (dst, src, count); break;
+    case 16: convert_565 (dst, src, bias, x, count); break;
+    case 15: convert_555 (dst, src, bias, x, count); break;
+    case 8:  convert_332 (dst, src, bias, x, count); break;
+  }
+}
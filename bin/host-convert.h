@@ -0,0 +1,50 @@
+/*
+ * 2014 (c) Øyvind Kolås
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#ifndef HOST_CONVERT_H
+#define HOST_CONVERT_H
+
+#include <stdint.h>
+
+typedef struct _HostConvert HostConvert;
+
+/* converts rows of 8bit RGBA client pixels to the pixel formats of fbdev
+ * framebuffers; formats with fewer than 8 bits per component are ordered
+ * dithered against an 8x8 Bayer tile anchored at the client origin, which
+ * keeps gradients free of banding at the cost of a saturating add per pixel.
+ */
+struct _HostConvert
+{
+  int     bits;       /* 32, 24, 16 (565), 15 (555), 8 (332 or gray) */
+  int     grayscale;  /* 8bit framebuffer holds luminance */
+  int     gray_bits;  /* 8, or 4 for 16 level eink panels */
+  int     dither;
+  uint8_t bias[8][128];
+};
+
+/* sets up conversion to the given format, dithering is on unless the
+ * MMM_DITHER environment variable is "0"
+ */
+void host_convert_init (HostConvert *convert, int bits,
+                        int grayscale, int gray_bits);
+
+/* converts count pixels from src to dst, x and y is the position of the
+ * first pixel, and pick the row and phase of the threshold tile
+ */
+void host_convert_row  (const HostConvert *convert,
+                        uint8_t *dst, const uint8_t *src,
+                        int x, int y, int count);
+
+#endif
@@ -0,0 +1,177 @@
+/*
+ * 2014 (c) Øyvind Kolås
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "mmm.h"
+#include <string.h>
+#include <stdint.h>
+
+#include "host.h"
+#include "host-cursor.h"
+
+#if 0
+static const uint8_t cursor_shape[16][16]={
+{1,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
+{1,2,1,1,0,0,0,0,0,0,0,0,0,0,0,0},
+{0,1,2,2,1,1,0,0,0,0,0,0,0,0,0,0},
+{0,1,2,2,2,2,1,1,0,0,0,0,0,0,0,0},
+{0,0,1,2,2,2,2,2,1,1,0,0,0,0,0,0},
+{0,0,1,2,2,2,2,2,2,2,1,1,0,0,0,0},
+{0,0,0,1,2,2,2,2,2,2,2,2,1,1,0,0},
+{0,0,0,1,2,2,2,2,1,1,1,1,1,1,1,1},
+{0,0,0,0,1,2,2,1,0,0,0,0,0,0,0,0},
+{0,0,0,0,1,2,2,1,0,0,0,0,0,0,0,0},
+{0,0,0,0,0,1,2,1,0,0,0,0,0,0,0,0},
+{0,0,0,0,0,1,2,1,0,0,0,0,0,0,0,0},
+{0,0,0,0,0,0,1,1,0,0,0,0,0,0,0,0},
+{0,0,0,0,0,0,1,1,0,0,0,0,0,0,0,0},
+{0,0,0,0,0,0,0,1,0,0,0,0,0,0,0,0},
+{0,0,0,0,0,0,0,1,0,0,0,0,0,0,0,0}};
+
+#else
+
+static const uint8_t cursor_shape[16][16]={
+{1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
+{1,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
+{1,2,1,0,0,0,0,0,0,0,0,0,0,0,0,0},
+{1,2,2,1,0,0,0,0,0,0,0,0,0,0,0,0},
+{1,2,2,2,1,0,0,0,0,0,0,0,0,0,0,0},
+{1,2,2,2,2,1,0,0,0,0,0,0,0,0,0,0},
+{1,2,2,2,2,2,1,0,0,0,0,0,0,0,0,0},
+{1,2,2,2,2,2,2,1,0,0,0,0,0,0,0,0},
+{1,2,2,2,2,2,2,2,1,0,0,0,0,0,0,0},
+{1,2,2,2,2,2,2,2,1,1,0,0,0,0,0,0},
+{1,2,2,2,2,2,1,1,0,0,0,0,0,0,0,0},
+{1,2,2,2,2,2,1,0,0,0,0,0,0,0,0,0},
+{1,2,1,1,2,2,1,0,0,0,0,0,0,0,0,0},
+{1,1,0,1,2,2,2,1,0,0,0,0,0,0,0,0},
+{0,0,0,0,1,2,2,1,0,0,0,0,0,0,0,0},
+{0,0,0,0,1,1,1,0,0,0,0,0,0,0,0,0}};
+
+#endif
+
+static void convert_pixel (Host *host, uint8_t *dst, const uint8_t *rgba)
+{
+  if (host->cache_convert)
+    host->cache_convert (host, dst, rgba, 0, 0, 1);
+  else
+    memcpy (dst, rgba, 4);
+}
+
+void host_cursor_init (HostCursor *cursor, Host *host)
+{
+  static const uint8_t white[4] = {255, 255, 255, 255};
+  static const uint8_t black[4] = {0, 0, 0, 255};
+  int u, v;
+
+  memset (cursor, 0, sizeof (HostCursor));
+  cursor->bpp = host->cache_bpp ? host->cache_bpp : 4;
+
+  for (v = 0; v < HOST_CURSOR_SIZE; v++)
+  {
+    int start = -1;
+
+    for (u = 0; u <= HOST_CURSOR_SIZE; u++)
+    {
+      int value = u < HOST_CURSOR_SIZE ? cursor_shape[v][u] : 0;
+      uint8_t *dst = cursor->sprite + (v * HOST_CURSOR_SIZE + u) * cursor->bpp;
+
+      if (value == 1)
+        convert_pixel (host, dst, white);
+      else if (value == 2)
+        convert_pixel (host, dst, black);
+
+      if (value && start < 0)
+      {
+        start = u;
+      }
+      else if (!value && start >= 0)
+      {
+        if (cursor->run_count[v] < HOST_CURSOR_MAX_RUNS)
+        {
+          cursor->runs[v][cursor->run_count[v] * 2]     = start;
+          cursor->runs[v][cursor->run_count[v] * 2 + 1] = u;
+          cursor->run_count[v]++;
+        }
+        start = -1;
+      }
+    }
+  }
+}
+
+void host_cursor_overlay (HostCursor *cursor, uint8_t *row,
+                          int y, int x0, int x1)
+{
+  int bpp = cursor->bpp;
+  int v = y - cursor->y;
+  int i;
+
+  if (!cursor->shown || v < 0 || v >= HOST_CURSOR_SIZE)
+    return;
+
+  for (i = 0; i < cursor->run_count[v]; i++)
+  {
+    int start = cursor->x + cursor->runs[v][i * 2];
+    int end   = cursor->x + cursor->runs[v][i * 2 + 1];
+
+    if (start < x0) start = x0;
+    if (end > x1)   end = x1;
+    if (end > start)
+      memcpy (row + (start - x0) * bpp,
+              cursor->sprite + (v * HOST_CURSOR_SIZE + start - cursor->x) * bpp,
+              (end - start) * bpp);
+  }
+}
+
+void host_cursor_draw (HostCursor *cursor, uint8_t *buffer, int stride,
+                       int width, int height, int x, int y)
+{
+  int bpp = cursor->bpp;
+  int x0 = x < 0 ? 0 : x;
+  int y0 = y < 0 ? 0 : y;
+  int x1 = x + HOST_CURSOR_SIZE > width ? width : x + HOST_CURSOR_SIZE;
+  int y1 = y + HOST_CURSOR_SIZE > height ? height : y + HOST_CURSOR_SIZE;
+  int scan;
+
+  cursor->shown = 1;
+  cursor->x = x;
+  cursor->y = y;
+  cursor->backup_x0 = x0;
+  cursor->backup_y0 = y0;
+  cursor->backup_x1 = x1;
+  cursor->backup_y1 = y1;
+
+  for (scan = y0; scan < y1; scan++)
+  {
+    uint8_t *row = buffer + scan * stride + x0 * bpp;
+    memcpy (cursor->backup + (scan - y0) * HOST_CURSOR_SIZE * bpp,
+            row, (x1 - x0) * bpp);
+    host_cursor_overlay (cursor, row, scan, x0, x1);
+  }
+}
+
+void host_cursor_undraw (HostCursor *cursor, uint8_t *buffer, int stride)
+{
+  int bpp = cursor->bpp;
+  int scan;
+
+  if (!cursor->shown)
+    return;
+
+  for (scan = cursor->backup_y0; scan < cursor->backup_y1; scan++)
+    memcpy (buffer + scan * stride + cursor->backup_x0 * bpp,
+            cursor->backup + (scan - cursor->backup_y0) * HOST_CURSOR_SIZE * bpp,
+            (cursor->backup_x1 - cursor->backup_x0) * bpp);
+  cursor->shown = 0;
+}
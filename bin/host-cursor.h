@@ -0,0 +1,73 @@
+/*
+ * 2014 (c) Øyvind Kolås
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#ifndef HOST_CURSOR_H
+#define HOST_CURSOR_H
+
+#include <stdint.h>
+
+/* The software mouse cursor, kept as a sprite in the native pixel format of
+ * the host. Hosts that compose into a shadow buffer never draw it there,
+ * it is laid over the rows that are uploaded to the display; hosts that draw
+ * directly to the display save and restore what is beneath it.
+ */
+
+#define HOST_CURSOR_SIZE     16
+#define HOST_CURSOR_MAX_RUNS 4
+
+typedef struct _HostCursor HostCursor;
+
+struct _HostCursor
+{
+  int      bpp;
+  uint8_t  sprite[HOST_CURSOR_SIZE * HOST_CURSOR_SIZE * 4];
+  /* the opaque spans of each row of the sprite, as start, end pairs */
+  uint8_t  runs[HOST_CURSOR_SIZE][HOST_CURSOR_MAX_RUNS * 2];
+  int      run_count[HOST_CURSOR_SIZE];
+
+  int      shown;
+  int      x;
+  int      y;
+
+  uint8_t  backup[HOST_CURSOR_SIZE * HOST_CURSOR_SIZE * 4];
+  int      backup_x0, backup_y0, backup_x1, backup_y1;
+};
+
+/* prepare the sprite, using host->cache_convert to reach the pixel format
+ * of the host.
+ */
+void host_cursor_init    (HostCursor *cursor, Host *host);
+
+/* lay the cursor over a row of pixels in the native format, row is the
+ * pixel at x0 on screen row y, and the row ends before x1.
+ */
+void host_cursor_overlay (HostCursor *cursor, uint8_t *row,
+                          int y, int x0, int x1);
+
+static inline int host_cursor_hits (HostCursor *cursor, int y, int x0, int x1)
+{
+  return cursor->shown &&
+         y >= cursor->y && y < cursor->y + HOST_CURSOR_SIZE &&
+         x1 > cursor->x && x0 < cursor->x + HOST_CURSOR_SIZE;
+}
+
+/* draw the cursor directly into a buffer that is shown, keeping what it
+ * covers so that host_cursor_undraw can restore it.
+ */
+void host_cursor_draw    (HostCursor *cursor, uint8_t *buffer, int stride,
+                          int width, int height, int x, int y);
+void host_cursor_undraw  (HostCursor *cursor, uint8_t *buffer, int stride);
+
+#endif
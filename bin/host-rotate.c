@@ -0,0 +1,173 @@
+/*
+ * 2014 (c) Øyvind Kolås
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "host-rotate.h"
+
+typedef struct { uint8_t b[3]; } Pixel24;
+
+/* dst advances by du for each logical pixel to the right and dv for each
+ * logical row down, for the quarter turns a logical column becomes a display
+ * row - which is written in increasing order, the display memory being
+ * write-combined, while the tile being read from stays in the cache.
+ */
+#define ROTATE_TILES(type)                                                  \
+  for (ty = 0; ty < height; ty += HOST_ROTATE_TILE)                         \
+  {                                                                         \
+    int th = height - ty < HOST_ROTATE_TILE ? height - ty : HOST_ROTATE_TILE;\
+    for (tx = 0; tx < width; tx += HOST_ROTATE_TILE)                        \
+    {                                                                       \
+      int tw = width - tx < HOST_ROTATE_TILE ? width - tx : HOST_ROTATE_TILE;\
+      for (u = 0; u < tw; u++)                                              \
+      {                                                                     \
+        const uint8_t *s = src + ty * src_stride + (tx + u) * sizeof (type);\
+        uint8_t *d = origin + (tx + u) * du + ty * dv;                      \
+        if (dv > 0)                                                         \
+          for (v = 0; v < th; v++, d += dv)                                 \
+            *(type*)d = *(const type*)(s + v * src_stride);                 \
+        else                                                                \
+          for (v = th - 1, d += v * dv; v >= 0; v--, d -= dv)               \
+            *(type*)d = *(const type*)(s + v * src_stride);                 \
+      }                                                                     \
+    }                                                                       \
+  }
+
+/* half a turn only reverses the rows */
+#define ROTATE_ROWS(type)                                                   \
+  for (v = 0; v < height; v++)                                              \
+  {                                                                         \
+    const type *s = (const type*)(src + v * src_stride);                    \
+    type *d = (type*)(origin + v * dv) - (width - 1);                       \
+    for (u = width - 1; u >= 0; u--)                                        \
+      *d++ = s[u];                                                          \
+  }
+
+void host_rotate_rect (uint8_t *dst, int dst_stride,
+                       int phys_width, int phys_height,
+                       const uint8_t *src, int src_stride, int bpp,
+                       int rotation, int x, int y, int width, int height)
+{
+  uint8_t *origin;
+  long du, dv;
+  int tx, ty, u, v;
+
+  switch (rotation)
+  {
+    case 90:
+      origin = dst + (phys_width - 1 - y) * bpp + x * dst_stride;
+      du = dst_stride;
+      dv = -bpp;
+      break;
+    case 180:
+      origin = dst + (phys_height - 1 - y) * dst_stride +
+                     (phys_width - 1 - x) * bpp;
+      du = -bpp;
+      dv = -dst_stride;
+      break;
+    case 270:
+      origin = dst + (phys_height - 1 - x) * dst_stride + y * bpp;
+      du = -dst_stride;
+      dv = bpp;
+      break;
+    default:
+      for (v = 0; v < height; v++)
+        memcpy (dst + (y + v) * dst_stride + x * bpp,
+                src + v * src_stride, width * bpp);
+      return;
+  }
+
+  if (rotation == 180)
+    switch (bpp)
+    {
+      case 4: ROTATE_ROWS (uint32_t); break;
+      case 3: ROTATE_ROWS (Pixel24); break;
+      case 2: ROTATE_ROWS (uint16_t); break;
+      case 1: ROTATE_ROWS (uint8_t); break;
+    }
+  else
+    switch (bpp)
+    {
+      case 4: ROTATE_TILES (uint32_t); break;
+      case 3: ROTATE_TILES (Pixel24); break;
+      case 2: ROTATE_TILES (uint16_t); break;
+      case 1: ROTATE_TILES (uint8_t); break;
+    }
+}
+
+void host_rotate_box (int rotation, int phys_width, int phys_height,
+                      int *x, int *y, int *width, int *height)
+{
+  int lx = *x;
+  int ly = *y;
+  int lw = *width;
+  int lh = *height;
+
+  switch (rotation)
+  {
+    case 90:
+      *x = phys_width - (ly + lh);
+      *y = lx;
+      *width = lh;
+      *height = lw;
+      break;
+    case 180:
+      *x = phys_width - (lx + lw);
+      *y = phys_height - (ly + lh);
+      break;
+    case 270:
+      *x = ly;
+      *y = phys_height - (lx + lw);
+      *width = lh;
+      *height = lw;
+      break;
+  }
+}
+
+void host_rotate_point (int rotation, int phys_width, int phys_height,
+                        float *x, float *y)
+{
+  float px = *x;
+  float py = *y;
+
+  switch (rotation)
+  {
+    case 90:
+      *x = py;
+      *y = phys_width - 1 - px;
+      break;
+    case 180:
+      *x = phys_width - 1 - px;
+      *y = phys_height - 1 - py;
+      break;
+    case 270:
+      *x = phys_height - 1 - py;
+      *y = px;
+      break;
+  }
+}
+
+int host_rotation_from_env (void)
+{
+  const char *env = getenv ("MMM_ROTATE");
+  int rotation = env ? atoi (env) : 0;
+
+  rotation = ((rotation % 360) + 360) % 360;
+  if (rotation % 90)
+    rotation = 0;
+  return rotation;
+}
@@ -0,0 +1,51 @@
+/*
+ * 2014 (c) Øyvind Kolås
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#ifndef HOST_ROTATE_H
+#define HOST_ROTATE_H
+
+#include <stdint.h>
+
+/* Rotation of the logical screen the clients are composited in onto a
+ * physically rotated display, by 0, 90, 180 or 270 degrees clockwise. The
+ * copies are done in square tiles, keeping both the rows read and the rows
+ * written within a few cache lines when transposing.
+ */
+
+#define HOST_ROTATE_TILE 32
+
+/* the rotation asked for with the MMM_ROTATE environment variable */
+int  host_rotation_from_env (void);
+
+/* copy the width x height pixels at src, which are those of the logical
+ * screen rectangle at x,y, to a display of phys_width x phys_height that
+ * starts at dst.
+ */
+void host_rotate_rect  (uint8_t *dst, int dst_stride,
+                        int phys_width, int phys_height,
+                        const uint8_t *src, int src_stride, int bpp,
+                        int rotation, int x, int y, int width, int height);
+
+/* map a rectangle of the logical screen to the one it covers on the
+ * display
+ */
+void host_rotate_box   (int rotation, int phys_width, int phys_height,
+                        int *x, int *y, int *width, int *height);
+
+/* map a position on the display to the logical screen */
+void host_rotate_point (int rotation, int phys_width, int phys_height,
+                        float *x, float *y);
+
+#endif
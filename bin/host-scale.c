@@ -0,0 +1,250 @@
+/*
+ * 2014 (c) Øyvind Kolås
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define HOST_SCALE_NEON 1
+#endif
+
+#include "host-scale.h"
+#include "host-bands.h"
+#include "host-blend.h"
+
+typedef struct _ScaleRows ScaleRows;
+
+struct _ScaleRows
+{
+  const HostScale *scale;
+  uint8_t         *dst;
+  int              dst_stride;
+  int              x0;
+  int              x1;
+  int              step;     /* 16.16 source pixels per screen pixel */
+};
+
+/* whole factor nearest scaling, replicating each pixel factor times */
+static void replicate_row (uint8_t *dst, const uint8_t *src, int bpp,
+                           int factor, int skip, int count)
+{
+  int i;
+
+  /* the first, partially covered, source pixel */
+  if (skip)
+  {
+    int n = factor - skip < count ? factor - skip : count;
+    for (i = 0; i < n; i++, dst += bpp)
+      memcpy (dst, src, bpp);
+    src += bpp;
+    count -= n;
+  }
+
+#if defined(__SSE2__)
+  if (bpp == 4 && factor == 2)
+  {
+    for (; count >= 8; count -= 8, src += 16, dst += 32)
+    {
+      __m128i v = _mm_loadu_si128 ((const __m128i*)src);
+      _mm_storeu_si128 ((__m128i*)dst, _mm_unpacklo_epi32 (v, v));
+      _mm_storeu_si128 ((__m128i*)(dst + 16), _mm_unpackhi_epi32 (v, v));
+    }
+  }
+#elif HOST_SCALE_NEON
+  if (bpp == 4 && factor == 2)
+  {
+    for (; count >= 8; count -= 8, src += 16, dst += 32)
+    {
+      uint32x4_t v = vld1q_u32 ((const uint32_t*)src);
+      uint32x4x2_t pair = {{v, v}};
+      vst2q_u32 ((uint32_t*)dst, pair);
+    }
+  }
+#endif
+
+  while (count > 0)
+  {
+    int n = factor < count ? factor : count;
+    for (i = 0; i < n; i++, dst += bpp)
+      memcpy (dst, src, bpp);
+    src += bpp;
+    count -= n;
+  }
+}
+
+static void nearest_row (uint8_t *dst, const HostScale *scale,
+                         const uint8_t *src, int step, int u0, int count)
+{
+  int bpp = scale->bpp;
+  int fx = u0 * step + step / 2;
+  int i;
+
+  for (i = 0; i < count; i++, dst += bpp, fx += step)
+  {
+    int sx = fx >> 16;
+    if (sx >= scale->src_width)
+      sx = scale->src_width - 1;
+    memcpy (dst, src + sx * bpp, bpp);
+  }
+}
+
+/* 32bit pixels only, wy is the weight of the row below, 0..256 */
+static void bilinear_row (uint8_t *dst, const HostScale *scale,
+                          const uint8_t *top, const uint8_t *bottom, int wy,
+                          int step, int u0, int count)
+{
+  int fx = u0 * step + step / 2 - 32768;
+  int last = scale->src_width - 1;
+  int i;
+#if defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128 ();
+  const __m128i wb = _mm_set1_epi16 (wy);
+  const __m128i wt = _mm_set1_epi16 (256 - wy);
+#endif
+
+  for (i = 0; i < count; i++, dst += 4, fx += step)
+  {
+    int sx = fx < 0 ? 0 : fx >> 16;
+    int sx1 = sx < last ? sx + 1 : last;
+    int wx = fx < 0 ? 0 : (fx >> 8) & 255;
+#if defined(__SSE2__)
+    __m128i t, b, v, w;
+    uint32_t p[2];
+
+    memcpy (&p[0], top + sx * 4, 4);
+    memcpy (&p[1], top + sx1 * 4, 4);
+    t = _mm_unpacklo_epi8 (_mm_loadl_epi64 ((const __m128i*)p), zero);
+    memcpy (&p[0], bottom + sx * 4, 4);
+    memcpy (&p[1], bottom + sx1 * 4, 4);
+    b = _mm_unpacklo_epi8 (_mm_loadl_epi64 ((const __m128i*)p), zero);
+
+    /* vertically, then the two resulting pixels horizontally */
+    v = _mm_srli_epi16 (_mm_add_epi16 (_mm_mullo_epi16 (t, wt),
+                                       _mm_mullo_epi16 (b, wb)), 8);
+    w = _mm_set_epi16 (wx, wx, wx, wx, 256 - wx, 256 - wx, 256 - wx, 256 - wx);
+    v = _mm_mullo_epi16 (v, w);
+    v = _mm_srli_epi16 (_mm_add_epi16 (v, _mm_srli_si128 (v, 8)), 8);
+    p[0] = _mm_cvtsi128_si32 (_mm_packus_epi16 (v, zero));
+    memcpy (dst, &p[0], 4);
+#elif HOST_SCALE_NEON
+    uint32x2_t t = vdup_n_u32 (0), b = vdup_n_u32 (0);
+    uint16x8_t v;
+    uint16x4_t h;
+
+    t = vld1_lane_u32 ((const uint32_t*)(top + sx * 4), t, 0);
+    t = vld1_lane_u32 ((const uint32_t*)(top + sx1 * 4), t, 1);
+    b = vld1_lane_u32 ((const uint32_t*)(bottom + sx * 4), b, 0);
+    b = vld1_lane_u32 ((const uint32_t*)(bottom + sx1 * 4), b, 1);
+
+    /* vertically, then the two resulting pixels horizontally */
+    v = vmulq_n_u16 (vmovl_u8 (vreinterpret_u8_u32 (t)), 256 - wy);
+    v = vmlaq_n_u16 (v, vmovl_u8 (vreinterpret_u8_u32 (b)), wy);
+    v = vshrq_n_u16 (v, 8);
+    h = vmul_n_u16 (vget_low_u16 (v), 256 - wx);
+    h = vmla_n_u16 (h, vget_high_u16 (v), wx);
+    h = vshr_n_u16 (h, 8);
+    vst1_lane_u32 ((uint32_t*)dst,
+                   vreinterpret_u32_u8 (vmovn_u16 (vcombine_u16 (h, h))), 0);
+#else
+    int c;
+
+    /* vertically, then the two resulting pixels horizontally */
+    for (c = 0; c < 4; c++)
+    {
+      int l = (top[sx * 4 + c] * (256 - wy) + bottom[sx * 4 + c] * wy) >> 8;
+      int r = (top[sx1 * 4 + c] * (256 - wy) + bottom[sx1 * 4 + c] * wy) >> 8;
+      dst[c] = (l * (256 - wx) + r * wx) >> 8;
+    }
+#endif
+  }
+}
+
+static void scale_rows (void *data, int y0, int y1)
+{
+  ScaleRows *rows = data;
+  const HostScale *scale = rows->scale;
+  int bpp = scale->bpp;
+  int count = rows->x1 - rows->x0;
+  int u0 = rows->x0 - scale->x;
+  int factor = (int) scale->scale;
+  int whole = scale->filter == HOST_SCALE_NEAREST &&
+              factor == scale->scale && factor >= 1;
+  int bilinear = scale->filter == HOST_SCALE_BILINEAR && bpp == 4;
+  uint8_t *tmp = NULL;
+  int dy;
+
+  if (scale->blend)
+    tmp = malloc (count * bpp);
+
+  for (dy = y0; dy < y1; dy++)
+  {
+    uint8_t *dst = rows->dst + dy * rows->dst_stride + rows->x0 * bpp;
+    uint8_t *out = tmp ? tmp : dst;
+    int v = dy - scale->y;
+
+    if (bilinear)
+    {
+      int fy = v * rows->step + rows->step / 2 - 32768;
+      int sy = fy < 0 ? 0 : fy >> 16;
+      int sy1 = sy < scale->src_height - 1 ? sy + 1 : sy;
+      int wy = fy < 0 ? 0 : (fy >> 8) & 255;
+
+      bilinear_row (out, scale, scale->src + sy * scale->src_stride,
+                    scale->src + sy1 * scale->src_stride, wy,
+                    rows->step, u0, count);
+    }
+    else
+    {
+      int sy = (v * rows->step + rows->step / 2) >> 16;
+      const uint8_t *src;
+
+      if (sy >= scale->src_height)
+        sy = scale->src_height - 1;
+      src = scale->src + sy * scale->src_stride;
+
+      if (whole)
+        replicate_row (out, src + (u0 / factor) * bpp, bpp, factor,
+                       u0 % factor, count);
+      else
+        nearest_row (out, scale, src, rows->step, u0, count);
+    }
+
+    if (tmp)
+      host_blend_over (dst, tmp, count);
+  }
+  free (tmp);
+}
+
+void host_scale_rect (const HostScale *scale, uint8_t *dst, int dst_stride,
+                      int x0, int y0, int x1, int y1)
+{
+  ScaleRows rows;
+
+  if (x1 <= x0 || y1 <= y0 || scale->scale <= 0.0f ||
+      scale->src_width <= 0 || scale->src_height <= 0)
+    return;
+
+  rows.scale = scale;
+  rows.dst = dst;
+  rows.dst_stride = dst_stride;
+  rows.x0 = x0;
+  rows.x1 = x1;
+  rows.step = 65536 / scale->scale;
+  host_bands_run (scale_rows, &rows, y0, y1, (x1 - x0) * scale->bpp);
+}
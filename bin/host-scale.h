@@ -0,0 +1,55 @@
+/*
+ * 2014 (c) Øyvind Kolås
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#ifndef HOST_SCALE_H
+#define HOST_SCALE_H
+
+#include <stdint.h>
+
+/* Clients can ask to be shown scaled, rendering fewer pixels than they
+ * cover, by setting the "scale" value to the factor, and "scale-filter" to
+ * "nearest" - the default, or "bilinear". Nearest scaling by whole factors
+ * replicates pixels, bilinear filtering needs 32bit pixels and falls back
+ * to nearest otherwise.
+ */
+
+typedef enum {
+  HOST_SCALE_NEAREST = 0,
+  HOST_SCALE_BILINEAR
+} HostScaleFilter;
+
+typedef struct _HostScale HostScale;
+
+struct _HostScale
+{
+  const uint8_t  *src;          /* the client cache */
+  int             src_stride;
+  int             src_width;
+  int             src_height;
+  int             bpp;
+  int             x;            /* client position on screen */
+  int             y;
+  float           scale;
+  HostScaleFilter filter;
+  int             blend;        /* premultiplied over, for 32bit pixels */
+};
+
+/* draws the part of the scaled client that falls within the screen
+ * rectangle x0,y0 - x1,y1 into dst, which points at the screen origin.
+ */
+void host_scale_rect (const HostScale *scale, uint8_t *dst, int dst_stride,
+                      int x0, int y0, int x1, int y1);
+
+#endif
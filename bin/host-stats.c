@@ -0,0 +1,254 @@
+/*
+ * 2014 (c) Øyvind Kolås
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include "mmm.h"
+#include "host.h"
+#include "host-stats.h"
+
+#define HOST_STATS_WINDOW 1000000 /* microseconds summed before publishing */
+
+static long  stats_start;
+static int   stats_frames;
+static long  stats_time[HOST_STAT_COUNT];
+static long  stats_bytes;
+
+/* per frame, of the last window */
+static float stats_fps;
+static float stats_ms[HOST_STAT_COUNT];
+static long  stats_frame_bytes;
+
+static int   hud_shown = -1; /* -1 until configured */
+
+static const char *stat_names[HOST_STAT_COUNT] = {
+  "read", "render", "cursor", "present", "epdc-wait"
+};
+
+/* 3x5 pixel glyphs from ' ' to 'Z', 3 bits per row with the top row in
+ * the high bits
+ */
+static const uint16_t hud_font[] = {
+  ['0' - ' '] = 0x7b6f, ['1' - ' '] = 0x2c97, ['2' - ' '] = 0x73e7,
+  ['3' - ' '] = 0x72cf, ['4' - ' '] = 0x5bc9, ['5' - ' '] = 0x79cf,
+  ['6' - ' '] = 0x79ef, ['7' - ' '] = 0x7249, ['8' - ' '] = 0x7bef,
+  ['9' - ' '] = 0x7bcf, ['.' - ' '] = 0x0002, ['-' - ' '] = 0x01c0,
+  [':' - ' '] = 0x0410, ['/' - ' '] = 0x12a4, ['A' - ' '] = 0x2bed,
+  ['B' - ' '] = 0x6bae, ['C' - ' '] = 0x3923, ['D' - ' '] = 0x6b6e,
+  ['E' - ' '] = 0x79a7, ['F' - ' '] = 0x79a4, ['G' - ' '] = 0x396b,
+  ['H' - ' '] = 0x5bed, ['I' - ' '] = 0x7497, ['J' - ' '] = 0x126a,
+  ['K' - ' '] = 0x5bad, ['L' - ' '] = 0x4927, ['M' - ' '] = 0x5fed,
+  ['N' - ' '] = 0x6b6d, ['O' - ' '] = 0x2b6a, ['P' - ' '] = 0x6ba4,
+  ['Q' - ' '] = 0x2b73, ['R' - ' '] = 0x6bad, ['S' - ' '] = 0x388e,
+  ['T' - ' '] = 0x7492, ['U' - ' '] = 0x5b6f, ['V' - ' '] = 0x5b6a,
+  ['W' - ' '] = 0x5bfd, ['X' - ' '] = 0x5aad, ['Y' - ' '] = 0x5a92,
+  ['Z' - ' '] = 0x72a7,
+};
+
+void host_stats_add (HostStat stat, long usecs)
+{
+  stats_time[stat] += usecs;
+}
+
+void host_stats_bytes (long bytes)
+{
+  stats_bytes += bytes;
+}
+
+void host_stats_client (Client *client, long usecs)
+{
+  stats_time[HOST_STAT_RENDER] += usecs;
+  client->stats_render += usecs;
+}
+
+/* the numbers as key value lines, renamed into place so that readers never
+ * see a partial file
+ */
+static void stats_write (Host *host)
+{
+  char path[512], tmp[512];
+  FILE *file;
+  int i;
+
+  snprintf (path, sizeof (path), "%s/.stats", host->fbdir);
+  snprintf (tmp, sizeof (tmp), "%s/.stats~", host->fbdir);
+  file = fopen (tmp, "w");
+  if (!file)
+    return;
+  fprintf (file, "fps %.1f\n", stats_fps);
+  for (i = 0; i < HOST_STAT_COUNT; i++)
+    fprintf (file, "%s-ms %.2f\n", stat_names[i], stats_ms[i]);
+  fprintf (file, "fb-bytes %li\n", stats_frame_bytes);
+  for (i = 0; i < host->client_count; i++)
+  {
+    Client *client = host->clients[i];
+    fprintf (file, "client %li %.2f %i %s\n", client->pid, client->render_ms,
+             client->stalls, mmm_get_title (client->mmm));
+  }
+  fclose (file);
+  rename (tmp, path);
+}
+
+void host_stats_frame (Host *host)
+{
+  long now = mmm_ticks ();
+  long elapsed;
+  int i;
+
+  stats_frames++;
+  elapsed = now - stats_start;
+  if (elapsed < HOST_STATS_WINDOW)
+    return;
+
+  stats_fps = stats_frames * 1000000.0f / elapsed;
+  for (i = 0; i < HOST_STAT_COUNT; i++)
+  {
+    stats_ms[i] = stats_time[i] / 1000.0f / stats_frames;
+    stats_time[i] = 0;
+  }
+  stats_frame_bytes = stats_bytes / stats_frames;
+  stats_bytes = 0;
+  for (i = 0; i < host->client_count; i++)
+  {
+    Client *client = host->clients[i];
+    client->render_ms = client->stats_render / 1000.0f / stats_frames;
+    client->stats_render = 0;
+  }
+  stats_frames = 0;
+  stats_start = now;
+
+  stats_write (host);
+}
+
+int host_stats_hud_shown (void)
+{
+  if (hud_shown == -1)
+  {
+    const char *env = getenv ("MMM_HUD");
+    hud_shown = env && strcmp (env, "0");
+  }
+  return hud_shown;
+}
+
+void host_stats_hud_rect (Host *host, MmmRectangle *rect)
+{
+  rect->x = host->width - HOST_HUD_WIDTH;
+  rect->y = 0;
+  rect->width = HOST_HUD_WIDTH;
+  rect->height = HOST_HUD_HEIGHT;
+  if (rect->x < 0)
+  {
+    rect->width += rect->x;
+    rect->x = 0;
+  }
+  if (rect->height > host->height)
+    rect->height = host->height;
+}
+
+void host_stats_hud_toggle (Host *host)
+{
+  MmmRectangle rect;
+
+  hud_shown = !host_stats_hud_shown ();
+  /* drawn with the next frame, or drawn over by the clients beneath */
+  host_stats_hud_rect (host, &rect);
+  host_add_dirt (host, rect.x, rect.y,
+                 rect.x + rect.width, rect.y + rect.height);
+}
+
+int host_stats_hud_event (Host *host, const char *event)
+{
+  if (strcmp (event, HOST_STATS_KEY))
+    return 0;
+  host_stats_hud_toggle (host);
+  return 1;
+}
+
+void host_stats_messages (Host *host)
+{
+  int i;
+  for (i = 0; i < host->client_count; i++)
+  {
+    Mmm *mmm = host->clients[i]->mmm;
+    const char *message;
+    while ((message = mmm_peek_message (mmm)) && !strcmp (message, "hud"))
+    {
+      mmm_get_message (mmm);
+      host_stats_hud_toggle (host);
+    }
+  }
+}
+
+/* one row of HUD text in client pixels, white on black */
+static void hud_text_row (uint32_t *row, int width, const char *text, int y)
+{
+  int x;
+
+  for (x = 0; x < width; x++)
+    row[x] = 0xff000000;
+  if (y >= 10)
+    return;
+  y /= 2;
+
+  for (x = 0; text[x] && x * 8 + 8 <= width; x++)
+  {
+    int c = text[x] >= 'a' && text[x] <= 'z' ? text[x] - 'a' + 'A' : text[x];
+    uint16_t glyph;
+    int u;
+
+    if (c <= ' ' || c > 'Z')
+      continue;
+    glyph = hud_font[c - ' '];
+    for (u = 0; u < 3; u++)
+      if (glyph & (1 << (14 - y * 3 - u)))
+        row[x * 8 + 2 + u * 2] = row[x * 8 + 3 + u * 2] = 0xffffffff;
+  }
+}
+
+void host_stats_hud_draw (Host *host, uint8_t *dst, int stride)
+{
+  char lines[HOST_HUD_LINES][64]; /* clipped to HOST_HUD_COLUMNS */
+  uint32_t row[HOST_HUD_WIDTH];
+  MmmRectangle rect;
+  int y;
+
+  snprintf (lines[0], sizeof (lines[0]), "FPS %-5.1f FB %liK",
+            stats_fps, stats_frame_bytes / 1024);
+  snprintf (lines[1], sizeof (lines[1]), "READ %-5.2f BLIT %.2f",
+            stats_ms[HOST_STAT_READ],
+            stats_ms[HOST_STAT_RENDER] - stats_ms[HOST_STAT_READ]);
+  snprintf (lines[2], sizeof (lines[2]), "CUR %-6.2f PRES %.2f",
+            stats_ms[HOST_STAT_CURSOR], stats_ms[HOST_STAT_PRESENT]);
+  snprintf (lines[3], sizeof (lines[3]), "EPDC %.2f",
+            stats_ms[HOST_STAT_EPDC_WAIT]);
+
+  host_stats_hud_rect (host, &rect);
+  for (y = 0; y < rect.height; y++)
+  {
+    int line = (y - 2) / 12;
+    if (y < 2 || line >= HOST_HUD_LINES)
+      hud_text_row (row, rect.width, "", 0);
+    else
+      hud_text_row (row, rect.width, lines[line], (y - 2) % 12);
+    if (host->cache_convert)
+      host->cache_convert (host, dst, (void*)row, rect.x, rect.y + y,
+                           rect.width);
+    else
+      memcpy (dst, row, rect.width * 4);
+    dst += stride;
+  }
+}
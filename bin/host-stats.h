@@ -0,0 +1,69 @@
+/*
+ * 2014 (c) Øyvind Kolås
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#ifndef HOST_STATS_H
+#define HOST_STATS_H
+
+#include <stdint.h>
+
+/* Self-profiling of the host, the time spent in each part of producing a
+ * frame is summed up over a second at a time, and then published as
+ * averages per frame - in a .stats file in fbdir for external tools, and
+ * in a HUD drawn over the top right corner of the screen.
+ *
+ * The HUD is shown with MMM_HUD=1, and toggled with control-alt-h or a
+ * "hud" message from a client.
+ */
+
+typedef enum {
+  HOST_STAT_READ,      /* waiting for and converting client frames */
+  HOST_STAT_RENDER,    /* compositing clients, including reading them */
+  HOST_STAT_CURSOR,
+  HOST_STAT_PRESENT,   /* uploading, flipping or submitting updates */
+  HOST_STAT_EPDC_WAIT, /* waiting on e-ink updates to complete */
+  HOST_STAT_COUNT
+} HostStat;
+
+#define HOST_STATS_KEY "control-alt-h"
+
+#define HOST_HUD_COLUMNS 20
+#define HOST_HUD_LINES   4
+#define HOST_HUD_WIDTH   (HOST_HUD_COLUMNS * 8 + 4)
+#define HOST_HUD_HEIGHT  (HOST_HUD_LINES * 12 + 4)
+
+/* add usecs microseconds to a part of the current frame */
+void host_stats_add        (HostStat stat, long usecs);
+/* bytes written to the framebuffer */
+void host_stats_bytes      (long bytes);
+/* the time spent rendering client this frame, part of HOST_STAT_RENDER */
+void host_stats_client     (Client *client, long usecs);
+/* end of a frame, publishing the numbers once a second */
+void host_stats_frame      (Host *host);
+
+int  host_stats_hud_shown  (void);
+void host_stats_hud_toggle (Host *host);
+/* toggles the HUD on HOST_STATS_KEY, returns 1 if event was taken */
+int  host_stats_hud_event  (Host *host, const char *event);
+/* takes "hud" messages off the queues of clients, toggling the HUD - the
+ * queue is read up to the first other message, left for its reader
+ */
+void host_stats_messages   (Host *host);
+void host_stats_hud_rect   (Host *host, MmmRectangle *rect);
+/* draw the HUD in the native format of the host, dst is the pixel at the
+ * top-left of host_stats_hud_rect
+ */
+void host_stats_hud_draw   (Host *host, uint8_t *dst, int stride);
+
+#endif
@@ -0,0 +1,214 @@
+/*
+ * 2014 (c) Øyvind Kolås
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include "mmm.h"
+#include "host.h"
+#include "host-trace.h"
+
+typedef struct _TraceEvent
+{
+  int64_t time;        /* of the input */
+  int64_t queued_time;
+  int     kind;
+} TraceEvent;
+
+typedef struct _TraceKind
+{
+  char    name[16];
+  int     count;
+  int     bucket[HOST_TRACE_BUCKETS];
+  int64_t total;       /* sums of the stages, in microseconds */
+  int64_t queue;
+  int64_t client;
+  int64_t host;
+  int64_t max;
+} TraceKind;
+
+static int        trace_enabled = -1; /* -1 until configured */
+static TraceEvent trace_event[HOST_TRACE_EVENTS];
+static int        trace_event_pos;
+static TraceKind  trace_kind[HOST_TRACE_KINDS];
+static int        trace_kind_count;
+static int        trace_unreported;
+static int64_t    trace_reported;
+
+static void trace_report (void)
+{
+  int i, j;
+
+  for (i = 0; i < trace_kind_count; i++)
+  {
+    TraceKind *kind = &trace_kind[i];
+    if (!kind->count)
+      continue;
+    fprintf (stderr, "latency %-14s %6i frames, mean %.1fms "
+             "(queue %.1f client %.1f host %.1f) max %.1fms\n  ms",
+             kind->name, kind->count,
+             kind->total / 1000.0 / kind->count,
+             kind->queue / 1000.0 / kind->count,
+             kind->client / 1000.0 / kind->count,
+             kind->host / 1000.0 / kind->count,
+             kind->max / 1000.0);
+    for (j = 0; j < HOST_TRACE_BUCKETS; j++)
+    {
+      if (j == HOST_TRACE_BUCKETS - 1)
+        fprintf (stderr, " >=%i:%i", 1 << (j - 1), kind->bucket[j]);
+      else
+        fprintf (stderr, " <%i:%i", 1 << j, kind->bucket[j]);
+    }
+    fprintf (stderr, "\n");
+  }
+  trace_unreported = 0;
+}
+
+static void trace_atexit (void)
+{
+  if (trace_unreported)
+    trace_report ();
+}
+
+int host_trace_enabled (void)
+{
+  if (trace_enabled == -1)
+  {
+    const char *env = getenv ("MMM_TRACE_LATENCY");
+    trace_enabled = env && strcmp (env, "0");
+    if (trace_enabled)
+    {
+      trace_reported = mmm_timestamp ();
+      atexit (trace_atexit);
+    }
+  }
+  return trace_enabled;
+}
+
+/* the first word of pointer and key events, other events are keys pressed */
+static int trace_kind_of (const char *event)
+{
+  char name[16];
+  int len, i;
+
+  if (!strncmp (event, "mouse-", 6) || !strncmp (event, "touch-", 6) ||
+      !strncmp (event, "key-", 4))
+  {
+    len = strcspn (event, " ");
+    if (len > (int)sizeof (name) - 1)
+      len = sizeof (name) - 1;
+    memcpy (name, event, len);
+    name[len] = 0;
+  }
+  else
+    strcpy (name, "key");
+
+  for (i = 0; i < trace_kind_count; i++)
+    if (!strcmp (trace_kind[i].name, name))
+      return i;
+  if (trace_kind_count == HOST_TRACE_KINDS)
+    return -1;
+  strcpy (trace_kind[trace_kind_count].name, name);
+  return trace_kind_count++;
+}
+
+void host_trace_event (const char *event, int64_t time, int64_t queued_time)
+{
+  TraceEvent *entry = &trace_event[trace_event_pos];
+
+  entry->time = time;
+  entry->queued_time = queued_time;
+  entry->kind = trace_kind_of (event);
+  trace_event_pos = (trace_event_pos + 1) % HOST_TRACE_EVENTS;
+}
+
+void host_trace_frame (Client *client)
+{
+  int64_t input_time, frame_time;
+
+  if (!host_trace_enabled ())
+    return;
+  /* a tag not yet presented belongs to a frame this one replaces */
+  if (mmm_get_frame_input (client->mmm, &input_time, &frame_time))
+  {
+    client->trace_input_time = input_time;
+    client->trace_frame_time = frame_time;
+  }
+}
+
+static TraceEvent *trace_lookup (int64_t time)
+{
+  int i;
+  for (i = 1; i <= HOST_TRACE_EVENTS; i++)
+  {
+    TraceEvent *entry = &trace_event[(trace_event_pos - i +
+                                      HOST_TRACE_EVENTS) % HOST_TRACE_EVENTS];
+    if (entry->time == time)
+      return entry;
+  }
+  return NULL;
+}
+
+static void trace_record (Client *client, int64_t present_time)
+{
+  TraceEvent *event = trace_lookup (client->trace_input_time);
+  TraceKind *kind;
+  int64_t total = present_time - client->trace_input_time;
+  int bucket;
+
+  /* events that scrolled out of the ring, or were queued by another host */
+  if (!event || event->kind < 0)
+    return;
+  kind = &trace_kind[event->kind];
+
+  for (bucket = 0; bucket < HOST_TRACE_BUCKETS - 1 &&
+                   total >= (1000 << bucket); bucket++);
+  kind->bucket[bucket]++;
+  kind->count++;
+  kind->total  += total;
+  kind->queue  += event->queued_time - event->time;
+  kind->client += client->trace_frame_time - event->queued_time;
+  kind->host   += present_time - client->trace_frame_time;
+  if (total > kind->max)
+    kind->max = total;
+  trace_unreported++;
+}
+
+void host_trace_presented (Host *host)
+{
+  int64_t now;
+  int i;
+
+  if (!host_trace_enabled ())
+    return;
+
+  now = mmm_timestamp ();
+  for (i = 0; i < host->client_count; i++)
+  {
+    Client *client = host->clients[i];
+    if (!client->trace_input_time)
+      continue;
+    trace_record (client, now);
+    client->trace_input_time = 0;
+  }
+
+  if (trace_unreported &&
+      now - trace_reported >= HOST_TRACE_REPORT * (int64_t)1000000)
+  {
+    trace_report ();
+    trace_reported = now;
+  }
+}
@@ -0,0 +1,50 @@
+/*
+ * 2014 (c) Øyvind Kolås
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#ifndef HOST_TRACE_H
+#define HOST_TRACE_H
+
+#include <stdint.h>
+
+/* Input-to-photon latency tracing, enabled by setting MMM_TRACE_LATENCY.
+ *
+ * Events are remembered with the time their input happened as they are
+ * queued for clients, clients tag the frame they commit with the newest
+ * event they read before it. When a tagged frame has been read and then
+ * presented, the time from input to present is added to a histogram for
+ * the kind of event, along with how it divides into the time until the
+ * event was queued, the time the client took and the time the host took.
+ * The histograms are written to stderr every HOST_TRACE_REPORT seconds
+ * while frames arrive, and at exit.
+ */
+
+#define HOST_TRACE_EVENTS   256  /* queued events remembered */
+#define HOST_TRACE_KINDS    16   /* kinds of events with a histogram */
+#define HOST_TRACE_BUCKETS  12   /* <1ms, <2ms, <4ms .. <1024ms and more */
+#define HOST_TRACE_REPORT   10
+
+int  host_trace_enabled   (void);
+
+/* an event was queued at queued_time, for input that happened at time */
+void host_trace_event     (const char *event, int64_t time,
+                           int64_t queued_time);
+
+/* picks up the tag of the frame just read from client */
+void host_trace_frame     (Client *client);
+
+/* the frames read since the last call are now on display */
+void host_trace_presented (Host *host);
+
+#endif
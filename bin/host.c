@@ -20,15 +20,157 @@ OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
 #include <dirent.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <sys/inotify.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "host.h"
+#include "host-scale.h"
+#include "host-composite.h"
+#include "host-trace.h"
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
 
 int host_has_quit = 0;
 
 int host_width = 200;
 int host_height = 200;
 
+/* held while the client table is modified, and by other threads (the audio
+ * mixer) while iterating it - the main thread can iterate without locking.
+ */
+static pthread_mutex_t clients_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void host_lock_clients (Host *host)
+{
+  pthread_mutex_lock (&clients_mutex);
+}
+
+void host_unlock_clients (Host *host)
+{
+  pthread_mutex_unlock (&clients_mutex);
+}
+
+static void host_add_client (Host *host, Client *client)
+{
+  host_lock_clients (host);
+  if (host->client_count + 1 > host->client_alloc)
+  {
+    host->client_alloc = host->client_alloc * 2 + 8;
+    host->clients = realloc (host->clients,
+                             sizeof (Client*) * host->client_alloc);
+  }
+  host->clients[host->client_count++] = client;
+  host_unlock_clients (host);
+  host->stacking_changed = 1;
+}
+
+static void host_remove_client (Host *host, Client *client)
+{
+  int i;
+  host_lock_clients (host);
+  for (i = 0; i < host->client_count; i++)
+    if (host->clients[i] == client)
+    {
+      memmove (&host->clients[i], &host->clients[i+1],
+               sizeof (Client*) * (host->client_count - i - 1));
+      host->client_count--;
+      break;
+    }
+  host_unlock_clients (host);
+  if (host->focused == client)
+    host->focused = NULL;
+  host->stacking_changed = 1;
+}
+
+/* queue a client for a damage check in the next host_idle_check */
+static void host_queue_rung (Host *host, Client *client)
+{
+  if (client->rung)
+    return;
+  if (host->rung_count + 1 > host->rung_alloc)
+  {
+    host->rung_alloc = host->rung_alloc * 2 + 8;
+    host->rung = realloc (host->rung, sizeof (Client*) * host->rung_alloc);
+  }
+  host->rung[host->rung_count++] = client;
+  client->rung = 1;
+}
+
+/* hand the client a doorbell slot, clients too old to ring it, or all
+ * clients if the host has no doorbell, are polled for damage instead.
+ */
+static void host_assign_doorbell (Host *host, Client *client)
+{
+  int slot;
+
+  if (client->pid == getpid ())
+    return;
+
+  for (slot = 1; slot < host->slot_alloc; slot++)
+    if (!host->slots[slot])
+      break;
+  if (host->doorbell_fd >= 0 && slot >= host->slot_alloc)
+  {
+    int old_alloc = host->slot_alloc;
+    host->slot_alloc = host->slot_alloc * 2 + 16;
+    host->slots = realloc (host->slots, sizeof (Client*) * host->slot_alloc);
+    memset (&host->slots[old_alloc], 0,
+            sizeof (Client*) * (host->slot_alloc - old_alloc));
+  }
+
+  if (host->doorbell_fd >= 0 &&
+      mmm_host_set_doorbell (client->mmm, slot))
+  {
+    host->slots[slot] = client;
+    client->doorbell = slot;
+    /* it might have committed a frame before it had a slot */
+    host_queue_rung (host, client);
+  }
+  else
+  {
+    host->polled_count++;
+  }
+}
+
+static void host_release_doorbell (Host *host, Client *client)
+{
+  int i;
+
+  if (client->doorbell)
+    host->slots[client->doorbell] = NULL;
+  else if (client->pid != getpid ())
+    host->polled_count--;
+
+  if (client->rung)
+    for (i = 0; i < host->rung_count; i++)
+      if (host->rung[i] == client)
+      {
+        host->rung[i] = host->rung[--host->rung_count];
+        break;
+      }
+}
+
+static void host_read_doorbell (Host *host)
+{
+  int32_t slots[256];
+  ssize_t len;
+
+  while ((len = read (host->doorbell_fd, slots, sizeof (slots))) > 0)
+  {
+    int i;
+    for (i = 0; i < len / (int)sizeof (int32_t); i++)
+      if (slots[i] > 0 && slots[i] < host->slot_alloc &&
+          host->slots[slots[i]])
+        host_queue_rung (host, host->slots[slots[i]]);
+  }
+}
+
 void host_clear_dirt (Host *host)
 {
   host->dirty_xmin = 10000;
@@ -57,37 +199,159 @@ int host_is_dirty (Host *host)
   return 0;
 }
 
-void validate_client (Host *host, const char *client_name)
+/* queue an event for a client, pointer and touch coordinates are mapped to
+ * the pixels of scaled clients.
+ */
+void host_client_add_event (Host *host, Client *client, const char *event)
+{
+  host_client_add_event_at (host, client, event, 0);
+}
+
+void host_client_add_event_at (Host *host, Client *client, const char *event,
+                               int64_t time)
 {
-  MmmList *l;
-  for (l = host->clients; l; l = l->next)
+  char buf[256];
+  const char *rest;
+  float x, y;
+  int len;
+
+  if (client->scale != 1.0f &&
+      (!strncmp (event, "mouse-", 6) || !strncmp (event, "touch-", 6)) &&
+      (rest = strchr (event, ' ')) &&
+      sscanf (rest, "%f %f%n", &x, &y, &len) == 2 &&
+      rest - event < 64)
   {
-    Client *client = l->data;
+    x = client->x + (x - client->x) / client->scale;
+    y = client->y + (y - client->y) / client->scale;
+    snprintf (buf, sizeof (buf), "%.*s %.0f %.0f%s",
+              (int)(rest - event), event, x, y, rest + len);
+    event = buf;
+  }
+
+  if (host_trace_enabled ())
+  {
+    int64_t now = mmm_timestamp ();
+    if (!time)
+      time = now;
+    host_trace_event (event, time, now);
+  }
+  mmm_add_event_at (client->mmm, event, time);
+}
+
+/* whether a translucent client is seen within the dirty region, what is
+ * beneath it then has to be cleared before the clients are drawn over it.
+ */
+int host_dirt_is_translucent (Host *host)
+{
+  int i;
+  for (i = 0; i < host->client_count; i++)
+  {
+    Client *client = host->clients[i];
+    if (client->translucent && !client->occluded &&
+        client->x < host->dirty_xmax &&
+        client->y < host->dirty_ymax &&
+        client->x + client->width > host->dirty_xmin &&
+        client->y + client->height > host->dirty_ymin)
+      return 1;
+  }
+  return 0;
+}
+
+/* refresh the cached geometry of a client, queuing redraws of the areas
+ * uncovered and covered if it moved, was resized, rescaled, restacked or
+ * changed between being opaque and translucent.
+ */
+static void client_update_geometry (Host *host, Client *client)
+{
+  int x = mmm_get_x (client->mmm);
+  int y = mmm_get_y (client->mmm);
+  int z = mmm_get_z (client->mmm);
+  int width = mmm_get_width (client->mmm);
+  int height = mmm_get_height (client->mmm);
+  const char *alpha = mmm_get_value (client->mmm, "alpha");
+  const char *scale_value = mmm_get_value (client->mmm, "scale");
+  const char *filter = mmm_get_value (client->mmm, "scale-filter");
+  int translucent = alpha && strcmp (alpha, "0");
+  float scale = scale_value ? atof (scale_value) : 1.0f;
+  int scale_filter = filter && !strcmp (filter, "bilinear") ?
+                       HOST_SCALE_BILINEAR : HOST_SCALE_NEAREST;
+
+  if (scale < 0.125f || scale > 16.0f)
+    scale = 1.0f;
+  if (scale != client->scale || scale_filter != client->scale_filter)
+  {
+    MmmRectangle rect = {client->x, client->y, client->width, client->height};
+    host_queue_draw (host, &rect);
+    client->scale = scale;
+    client->scale_filter = scale_filter;
+  }
+  width = width * scale + 0.5f;
+  height = height * scale + 0.5f;
+
+  if (translucent != client->translucent)
+  {
+    MmmRectangle rect = {client->x, client->y, client->width, client->height};
+    host_queue_draw (host, &rect);
+    client->translucent = translucent;
+    host->stacking_changed = 1;
+  }
+
+  if (x != client->x || y != client->y || z != client->z ||
+      width != client->width || height != client->height)
+  {
+    MmmRectangle old_rect = {client->x, client->y, client->width, client->height};
+    MmmRectangle new_rect = {x, y, width, height};
+    host_queue_draw (host, &old_rect);
+    host_queue_draw (host, &new_rect);
+
+    client->x = x;
+    client->y = y;
+    client->z = z;
+    client->width = width;
+    client->height = height;
+    host->stacking_changed = 1;
+  }
+}
+
+static Client *host_find_client (Host *host, const char *client_name)
+{
+  int i;
+  for (i = 0; i < host->client_count; i++)
+  {
+    Client *client = host->clients[i];
     if (client->filename &&
         !strcmp (client->filename, client_name))
-    {
-      return;
-    }
+      return client;
   }
+  return NULL;
+}
+
+void validate_client (Host *host, const char *client_name)
+{
+  if (host_find_client (host, client_name))
+    return;
 
   {
+    static int serial = 0;
     Client *client = calloc (sizeof (Client), 1);
 
     char tmp[256];
     sprintf (tmp, "%s/%s", host->fbdir, client_name);
     client->mmm = mmm_host_open (tmp);
-    client->pid = mmm_client_pid (client->mmm);
 
-    if (client->pid == 0)
+    if (!client->mmm)
     {
-      mmm_destroy (client->mmm);
+      fprintf (stderr, "failed to open client %s\n", tmp);
       free (client);
       return;
     }
 
-    if (!client->mmm)
+    client->pid = mmm_client_pid (client->mmm);
+
+    if (client->pid == 0)
     {
-      fprintf (stderr, "failed to open client %s\n", tmp);
+      mmm_destroy (client->mmm);
+      free (client);
       return;
     }
 
@@ -100,6 +364,19 @@ void validate_client (Host *host, const char *client_name)
     }
 
     client->filename = strdup (client_name);
+    client->serial = serial++;
+
+    /* becomes readable when the client exits, and unlike the pid it
+     * cannot come to refer to another process.
+     */
+    client->pidfd = syscall (SYS_pidfd_open, (pid_t)client->pid, 0);
+    client->watch.type = HOST_WATCH_CLIENT;
+    client->watch.data = client;
+    if (client->pidfd >= 0 && host->watch_fd >= 0)
+    {
+      struct epoll_event event = {EPOLLIN, {.ptr = &client->watch}};
+      epoll_ctl (host->watch_fd, EPOLL_CTL_ADD, client->pidfd, &event);
+    }
 
     if (client->pid != getpid ())
     {
@@ -122,13 +399,18 @@ void validate_client (Host *host, const char *client_name)
         }
       }
     }
-    mmm_list_append (&host->clients, client);
+    client_update_geometry (host, client);
+    host_add_client (host, client);
+    host_assign_doorbell (host, client);
+    if (host->copy_rects)
+      mmm_host_accept_copies (client->mmm);
 
-  if (host->single_app)
-    host->focused = client;
+    if (host->single_app)
+      host->focused = client;
   }
 }
 
+/* fallback for kernels without pidfd_open */
 static int pid_is_alive (long pid)
 {
   char path[256];
@@ -155,81 +437,681 @@ void host_queue_draw (Host *host, MmmRectangle *rect)
 
 }
 
-void host_monitor_dir (Host *host)
+static void host_destroy_client (Host *host, Client *client)
 {
-  MmmList *l;
-again:
-  for (l = host->clients; l; l = l->next)
+  char tmp[256];
+  sprintf (tmp, "%s/%s", host->fbdir, client->filename);
+  host_remove_client (host, client);
+  host_release_doorbell (host, client);
+  if (client->pidfd >= 0)
+    close (client->pidfd);
+  if (client->mmm)
   {
-    Client *client = l->data;
-    if (!pid_is_alive (client->pid))
+    mmm_destroy (client->mmm);
+    client->mmm = NULL;
+  }
+
+  unlink (tmp);
+  host_has_quit = 1;
+  host_client_free_cache (client);
+  free (client->filename);
+  free (client);
+
+  host_queue_draw (host, NULL);
+}
+
+/* names of files that have appeared but could not yet be opened as
+ * clients, typically since the client has not finished initializing the
+ * header - these are retried less and less often until they succeed or
+ * vanish, and left alone after HOST_PENDING_TRIES until they change.
+ */
+static void host_add_pending (Host *host, const char *name, int changed)
+{
+  HostPending *pending;
+  int i;
+  for (i = 0; i < host->pending_count; i++)
+    if (!strcmp (host->pending[i].name, name))
     {
-      char tmp[256];
-      sprintf (tmp, "%s/%s", host->fbdir, client->filename);
-      if (client->mmm)
+      if (changed)
       {
-        mmm_destroy (client->mmm);
-        client->mmm = NULL;
+        host->pending[i].tries = 0;
+        host->pending[i].next = 0;
       }
+      return;
+    }
+  host->pending = realloc (host->pending,
+                           sizeof (HostPending) * (host->pending_count + 1));
+  pending = &host->pending[host->pending_count++];
+  pending->name = strdup (name);
+  pending->tries = 0;
+  pending->next = 0;
+}
 
-      unlink (tmp);
-      host_has_quit = 1;
-      free (client);
-      mmm_list_remove (&host->clients, client);
+static void host_drop_pending (Host *host, int no)
+{
+  free (host->pending[no].name);
+  host->pending[no] = host->pending[--host->pending_count];
+}
+
+/* clients make their file world accessible once it has been sized and the
+ * header initialized, only then is it safe to map.
+ */
+static void host_check_pending (Host *host)
+{
+  int64_t now = mmm_ticks ();
+  int i;
+  for (i = host->pending_count - 1; i >= 0; i--)
+  {
+    HostPending *pending = &host->pending[i];
+    char path[256];
+    struct stat sts;
+
+    if (pending->tries >= HOST_PENDING_TRIES || pending->next > now)
+      continue;
 
-      host_queue_draw (host, NULL);
-      goto again;
+    sprintf (path, "%s/%s", host->fbdir, pending->name);
+    if (stat (path, &sts) == -1)
+    {
+      host_drop_pending (host, i);
+      continue;
+    }
+    if ((sts.st_mode & 0777) == 0777)
+    {
+      validate_client (host, pending->name);
+      if (host_find_client (host, pending->name))
+      {
+        host_drop_pending (host, i);
+        continue;
+      }
     }
+    pending->next = now + (HOST_POLL_INTERVAL * 1000LL << pending->tries);
+    pending->tries++;
   }
+}
 
+static void host_scan_dir (Host *host)
+{
   DIR *dir = opendir (host->fbdir);
   struct dirent *ent;
-  static int iteration = 0;
-
-  iteration ++;
 
+  if (!dir)
+    return;
   while ((ent = readdir (dir)))
   {
-    if (ent->d_name[0]!='.')
-      validate_client (host, ent->d_name);
+    if (ent->d_name[0]!='.' &&
+        !host_find_client (host, ent->d_name))
+      host_add_pending (host, ent->d_name, 0);
   }
   closedir (dir);
 }
 
+static void host_read_inotify (Host *host)
+{
+  char buf[4096] __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+  ssize_t len;
+
+  while ((len = read (host->inotify_fd, buf, sizeof (buf))) > 0)
+  {
+    char *ptr;
+    for (ptr = buf; ptr < buf + len;
+         ptr += sizeof (struct inotify_event) + ((struct inotify_event*)ptr)->len)
+    {
+      struct inotify_event *event = (void*)ptr;
+
+      if (event->mask & IN_Q_OVERFLOW)
+      {
+        host_scan_dir (host);
+        continue;
+      }
+      if (!event->len || event->name[0] == '.')
+        continue;
+
+      if (event->mask & (IN_DELETE | IN_MOVED_FROM))
+      {
+        Client *client = host_find_client (host, event->name);
+        int i;
+        for (i = 0; i < host->pending_count; i++)
+          if (!strcmp (host->pending[i].name, event->name))
+            host_drop_pending (host, i);
+        if (client)
+          host_destroy_client (host, client);
+      }
+      else if (!host_find_client (host, event->name))
+      {
+        host_add_pending (host, event->name, 1);
+      }
+    }
+  }
+}
+
+static HostWatch input_watch = {HOST_WATCH_INPUT, NULL};
+
+/* sets up the epoll set, the inotify watch of fbdir and queues the
+ * initial scan - done on first use.
+ */
+static void host_watch_init (Host *host)
+{
+  if (host->monitoring)
+    return;
+  host->monitoring = 1;
+
+  host->watch_fd = epoll_create1 (EPOLL_CLOEXEC);
+  host->inotify_fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+  if (host->inotify_fd >= 0 &&
+      inotify_add_watch (host->inotify_fd, host->fbdir,
+                         IN_CREATE | IN_CLOSE_WRITE | IN_ATTRIB |
+                         IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM) < 0)
+  {
+    close (host->inotify_fd);
+    host->inotify_fd = -1;
+  }
+  if (host->inotify_fd < 0)
+    fprintf (stderr, "inotify unavailable, polling %s\n", host->fbdir);
+  else if (host->watch_fd >= 0)
+  {
+    struct epoll_event event = {EPOLLIN, {.ptr = &host->dir_watch}};
+    host->dir_watch.type = HOST_WATCH_DIR;
+    epoll_ctl (host->watch_fd, EPOLL_CTL_ADD, host->inotify_fd, &event);
+  }
+
+  /* clients write their doorbell slot here when they have new damage,
+   * opened read-write to never see end of file.
+   */
+  host->doorbell_fd = -1;
+  if (host->watch_fd >= 0)
+  {
+    char path[256];
+    sprintf (path, "%s/.doorbell", host->fbdir);
+    unlink (path);
+    if (mkfifo (path, 0666) == 0)
+    {
+      chmod (path, 0666);
+      host->doorbell_fd = open (path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    }
+    if (host->doorbell_fd >= 0)
+    {
+      struct epoll_event event = {EPOLLIN, {.ptr = &host->doorbell_watch}};
+      host->doorbell_watch.type = HOST_WATCH_DOORBELL;
+      epoll_ctl (host->watch_fd, EPOLL_CTL_ADD, host->doorbell_fd, &event);
+    }
+    else
+      fprintf (stderr, "no doorbell in %s, polling clients\n", host->fbdir);
+  }
+
+  host_scan_dir (host);
+}
+
+void host_watch_fd (Host *host, int fd)
+{
+  struct epoll_event event = {EPOLLIN, {.ptr = &input_watch}};
+  host_watch_init (host);
+  if (host->watch_fd >= 0 && fd >= 0)
+    epoll_ctl (host->watch_fd, EPOLL_CTL_ADD, fd, &event);
+}
+
+int host_get_fd (Host *host)
+{
+  host_watch_init (host);
+  return host->watch_fd;
+}
+
+int host_poll_interval (Host *host)
+{
+  int64_t now = mmm_ticks ();
+  int interval = -1;
+  int i;
+
+  /* no way to be told about changes in fbdir, or clients without a
+   * doorbell
+   */
+  if (host->inotify_fd < 0 || host->watch_fd < 0 || host->polled_count)
+    return HOST_POLL_INTERVAL;
+  /* files waiting to become valid clients, until they are given up on */
+  for (i = 0; i < host->pending_count; i++)
+    if (host->pending[i].tries < HOST_PENDING_TRIES)
+    {
+      int wait = host->pending[i].next > now ?
+                 (host->pending[i].next - now + 999) / 1000 : 0;
+      if (interval < 0 || wait < interval)
+        interval = wait;
+    }
+  /* nothing tells us when clients without a pidfd exit */
+  for (i = 0; i < host->client_count; i++)
+    if (host->clients[i]->pidfd < 0 &&
+        (interval < 0 || HOST_REAP_INTERVAL < interval))
+      interval = HOST_REAP_INTERVAL;
+  return interval;
+}
+
+int host_wait (Host *host, int timeout)
+{
+  int inotify_ready = 0;
+  int got_input = 0;
+  int interval;
+  int i;
+
+  host_watch_init (host);
+
+  interval = host_poll_interval (host);
+  if (interval >= 0 && (timeout < 0 || interval < timeout))
+    timeout = interval;
+
+  if (host->watch_fd >= 0)
+  {
+    struct epoll_event events[32];
+    int count = epoll_wait (host->watch_fd, events, 32, timeout);
+
+    /* exited clients first, the inotify events might also remove them */
+    for (i = 0; i < count; i++)
+    {
+      HostWatch *watch = events[i].data.ptr;
+      switch (watch->type)
+      {
+        case HOST_WATCH_CLIENT: host_destroy_client (host, watch->data); break;
+        case HOST_WATCH_DIR:    inotify_ready = 1; break;
+        case HOST_WATCH_DOORBELL: host_read_doorbell (host); break;
+        case HOST_WATCH_INPUT:  got_input = 1; break;
+      }
+    }
+  }
+  else
+  {
+    if (timeout > 0)
+      usleep (timeout * 1000);
+    inotify_ready = 1;
+  }
+
+  if (host->inotify_fd < 0)
+    host_scan_dir (host);
+
+  /* clients without a pidfd that crashed leave their file behind */
+  for (i = host->client_count - 1; i >= 0; i--)
+  {
+    Client *client = host->clients[i];
+    if (client->pidfd < 0 && !pid_is_alive (client->pid))
+      host_destroy_client (host, client);
+  }
+
+  if (inotify_ready && host->inotify_fd >= 0)
+    host_read_inotify (host);
+  host_check_pending (host);
+
+  return got_input;
+}
+
+void host_monitor_dir (Host *host)
+{
+  host_wait (host, 0);
+}
+
 void host_window_raise (Host *host, Client *focused)
 {
   if (!focused)
     return;
 
-  mmm_list_remove (&host->clients, focused);
-  mmm_list_append (&host->clients, focused);
+  if (host->client_count)
+  {
+    Client *top = host->clients[host->client_count-1];
+    if (top != focused)
+      mmm_set_z (focused->mmm, top->z + 1);
+  }
+  client_update_geometry (host, focused);
+}
+
+/* queues the screen area showing the rectangle x,y width,height of the
+ * client, scaled clients show it over more or fewer pixels, and bilinear
+ * filtering spreads it one pixel further.
+ */
+static void client_queue_draw (Host *host, Client *client,
+                               int x, int y, int width, int height)
+{
+  MmmRectangle rect;
+
+  if (client->scale != 1.0f)
+  {
+    float x0 = x * client->scale;
+    float y0 = y * client->scale;
+    float x1 = (x + width) * client->scale;
+    float y1 = (y + height) * client->scale;
+    int grow = client->scale_filter == HOST_SCALE_BILINEAR;
+
+    x = (int)x0 - (x0 < (int)x0) - grow;
+    y = (int)y0 - (y0 < (int)y0) - grow;
+    width = (int)x1 + (x1 > (int)x1) + grow - x;
+    height = (int)y1 + (y1 > (int)y1) + grow - y;
+  }
+  rect.x = client->x + x;
+  rect.y = client->y + y;
+  rect.width = width;
+  rect.height = height;
+  host_queue_draw (host, &rect);
 }
 
+static void client_check_damage (Host *host, Client *client)
+{
+  int x, y, width, height;
+  if (mmm_get_damage (client->mmm, &x, &y, &width, &height))
+  {
+    MmmRectangle copy;
+    int dx, dy;
+
+    client_update_geometry (host, client);
+
+    /* pixels the client moved are moved in the cache and on screen at
+     * once when the host can, otherwise the destination is redrawn - from
+     * the cache moved now, or as the frame is read.
+     */
+    if (!client->copy_applied &&
+        mmm_get_copy (client->mmm, &copy, &dx, &dy))
+    {
+      MmmRectangle rect = {client->x + copy.x, client->y + copy.y,
+                           copy.width, copy.height};
+
+      if (host->copy_rect && host_client_move (host, client, &copy, dx, dy))
+        client->copy_applied = 1;
+      if (!client->copy_applied ||
+          !host->copy_rect (host, client, &rect, dx, dy))
+        client_queue_draw (host, client, copy.x + dx, copy.y + dy,
+                           copy.width, copy.height);
+    }
+
+    if (width)
+      client_queue_draw (host, client, x, y, width, height);
+    else
+    {
+      MmmRectangle rect = {client->x, client->y, client->width, client->height};
+      host_queue_draw (host, &rect);
+      // fprintf (stderr, "client might be dead.. \n");
+    }
+  }
+}
+
+/* checks the clients that rang the doorbell, and any that have to be
+ * polled, for damage
+ */
 int host_idle_check (void *data)
 {
   Host *host = data;
-  MmmList *l;
-  for (l = host->clients; l; l = l->next)
+  int i;
+
+  for (i = 0; i < host->rung_count; i++)
+  {
+    Client *client = host->rung[i];
+    client->rung = 0;
+    /* re-armed before looking, a frame committed after this rings again */
+    mmm_host_doorbell_ack (client->mmm);
+    client_check_damage (host, client);
+  }
+  host->rung_count = 0;
+
+  if (host->polled_count)
+    for (i = 0; i < host->client_count; i++)
+    {
+      Client *client = host->clients[i];
+      if (!client->doorbell && client->pid != getpid ())
+        client_check_damage (host, client);
+    }
+  return 1;
+}
+
+/* store the up to four parts of a not covered by b in out, returning the
+ * number of rectangles written.
+ */
+static int rect_subtract (const MmmRectangle *a, const MmmRectangle *b,
+                          MmmRectangle *out)
+{
+  int ax1 = a->x + a->width;
+  int ay1 = a->y + a->height;
+  int bx1 = b->x + b->width;
+  int by1 = b->y + b->height;
+  int y0, y1;
+  int count = 0;
+
+  if (b->x >= ax1 || bx1 <= a->x ||
+      b->y >= ay1 || by1 <= a->y)
+  {
+    out[0] = *a;
+    return 1;
+  }
+
+  y0 = a->y > b->y ? a->y : b->y;
+  y1 = ay1 < by1 ? ay1 : by1;
+
+  if (b->y > a->y)
+  {
+    MmmRectangle r = {a->x, a->y, a->width, b->y - a->y};
+    out[count++] = r;
+  }
+  if (by1 < ay1)
+  {
+    MmmRectangle r = {a->x, by1, a->width, ay1 - by1};
+    out[count++] = r;
+  }
+  if (b->x > a->x)
+  {
+    MmmRectangle r = {a->x, y0, b->x - a->x, y1 - y0};
+    out[count++] = r;
+  }
+  if (bx1 < ax1)
   {
-    Client *client = l->data;
+    MmmRectangle r = {bx1, y0, ax1 - bx1, y1 - y0};
+    out[count++] = r;
+  }
+  return count;
+}
+
+/* remove the area covered by occluder from the visible region of client,
+ * when the result would need more than HOST_MAX_VISIBLE rectangles the
+ * occluder is ignored; which keeps the region a conservative superset.
+ */
+static void client_occlude (Client *client, const MmmRectangle *occluder)
+{
+  MmmRectangle pieces[HOST_MAX_VISIBLE * 4];
+  int count = 0;
+  int i;
+
+  for (i = 0; i < client->visible_count; i++)
+    count += rect_subtract (&client->visible[i], occluder, &pieces[count]);
+
+  if (count > HOST_MAX_VISIBLE)
+    return;
 
-    int x, y, width, height;
-    if (mmm_get_damage (client->mmm, &x, &y, &width, &height))
+  memcpy (client->visible, pieces, sizeof (MmmRectangle) * count);
+  client->visible_count = count;
+}
+
+/* insertion sort of the client table on z, keeping the order of addition
+ * among clients with equal z, cheap for the mostly sorted table.
+ */
+static void host_restack (Host *host)
+{
+  int i;
+  host_lock_clients (host);
+  for (i = 1; i < host->client_count; i++)
+  {
+    Client *client = host->clients[i];
+    int j = i - 1;
+    while (j >= 0 &&
+           (host->clients[j]->z > client->z ||
+            (host->clients[j]->z == client->z &&
+             host->clients[j]->serial > client->serial)))
     {
-      if (width)
+      host->clients[j+1] = host->clients[j];
+      j--;
+    }
+    host->clients[j+1] = client;
+  }
+  host_unlock_clients (host);
+}
+
+/* the grid cell range, x0,y0 - x1,y1 inclusive, covered by a rectangle */
+static int host_grid_range (Host *host, const MmmRectangle *rect,
+                            int *x0, int *y0, int *x1, int *y1)
+{
+  int cell_width  = (host->width  + HOST_GRID_SIZE - 1) / HOST_GRID_SIZE;
+  int cell_height = (host->height + HOST_GRID_SIZE - 1) / HOST_GRID_SIZE;
+  int rx0 = rect->x;
+  int ry0 = rect->y;
+  int rx1 = rect->x + rect->width - 1;
+  int ry1 = rect->y + rect->height - 1;
+
+  if (cell_width < 1)  cell_width = 1;
+  if (cell_height < 1) cell_height = 1;
+  if (rx0 < 0) rx0 = 0;
+  if (ry0 < 0) ry0 = 0;
+  if (rx1 >= host->width)  rx1 = host->width - 1;
+  if (ry1 >= host->height) ry1 = host->height - 1;
+  if (rx1 < rx0 || ry1 < ry0)
+    return 0;
+
+  *x0 = rx0 / cell_width;
+  *y0 = ry0 / cell_height;
+  *x1 = rx1 / cell_width;
+  *y1 = ry1 / cell_height;
+  return 1;
+}
+
+/* rebuild the uniform grid used for hit-testing, each cell lists the
+ * clients overlapping it in stacking order.
+ */
+static void host_rebuild_grid (Host *host)
+{
+  int i;
+
+  if (!host->grid)
+    host->grid = calloc (sizeof (HostCell), HOST_GRID_SIZE * HOST_GRID_SIZE);
+  for (i = 0; i < HOST_GRID_SIZE * HOST_GRID_SIZE; i++)
+    host->grid[i].count = 0;
+
+  for (i = 0; i < host->client_count; i++)
+  {
+    Client *client = host->clients[i];
+    MmmRectangle rect = {client->x, client->y, client->width, client->height};
+    int x0, y0, x1, y1;
+    int u, v;
+
+    if (client->pid == getpid ())
+      continue;
+    if (!host_grid_range (host, &rect, &x0, &y0, &x1, &y1))
+      continue;
+
+    for (v = y0; v <= y1; v++)
+      for (u = x0; u <= x1; u++)
       {
-        MmmRectangle rect = {mmm_get_x (client->mmm)+x, mmm_get_y (client->mmm) + y,
-                             width, height};
-        host_queue_draw (host, &rect);
+        HostCell *cell = &host->grid[v * HOST_GRID_SIZE + u];
+        if (cell->count + 1 > cell->alloc)
+        {
+          cell->alloc = cell->alloc * 2 + 4;
+          cell->clients = realloc (cell->clients, sizeof (Client*) * cell->alloc);
+        }
+        cell->clients[cell->count++] = client;
       }
-      else
+  }
+}
+
+Client *host_client_at (Host *host, int x, int y)
+{
+  MmmRectangle point = {x, y, 1, 1};
+  HostCell *cell;
+  int u, v;
+  int i;
+
+  host_update_visibility (host);
+  if (!host->grid ||
+      !host_grid_range (host, &point, &u, &v, &u, &v))
+    return NULL;
+
+  cell = &host->grid[v * HOST_GRID_SIZE + u];
+  for (i = cell->count - 1; i >= 0; i--)
+  {
+    Client *client = cell->clients[i];
+    if (x >= client->x && x < client->x + client->width &&
+        y >= client->y && y < client->y + client->height)
+      return client;
+  }
+  return NULL;
+}
+
+void host_pointer_focus (Host *host, int x, int y)
+{
+  if (!host->single_app)
+    host->focused = host_client_at (host, x, y);
+}
+
+void host_event_focus (Host *host, const char *event)
+{
+  float x, y;
+  if (strncmp (event, "mouse-", 6))
+    return;
+  event = strchr (event, ' ');
+  if (event && sscanf (event, "%f %f", &x, &y) == 2)
+    host_pointer_focus (host, x, y);
+}
+
+/* brings the client table back in z order after stacking or geometry
+ * changes, and recomputes, from the stacking order and the client
+ * rectangles, which parts of each client are visible - only opaque clients
+ * hide what is beneath them. Fully covered clients get occluded set, and
+ * are sent a "visibility hidden" event, with a "visibility visible" event
+ * sent when they become uncovered again.
+ */
+void host_update_visibility (Host *host)
+{
+  MmmRectangle *occluders;
+  int occluder_count = 0;
+  int i;
+
+  if (!host->stacking_changed)
+    return;
+  host->stacking_changed = 0;
+
+  host_restack (host);
+  host_rebuild_grid (host);
+
+  if (!host->client_count)
+    return;
+
+  occluders = malloc (sizeof (MmmRectangle) * host->client_count);
+
+  /* walk from the top-most client and downwards */
+  for (i = host->client_count - 1; i >= 0; i--)
+  {
+    Client *client = host->clients[i];
+    MmmRectangle rect = {client->x, client->y, client->width, client->height};
+    int was_occluded = client->occluded;
+    int j;
+
+    if (client->pid == getpid ())
+      continue;
+
+    client->visible_count = 0;
+    {
+      int x0 = rect.x < 0 ? 0 : rect.x;
+      int y0 = rect.y < 0 ? 0 : rect.y;
+      int x1 = rect.x + rect.width;
+      int y1 = rect.y + rect.height;
+      if (x1 > host->width)  x1 = host->width;
+      if (y1 > host->height) y1 = host->height;
+
+      if (x1 > x0 && y1 > y0)
       {
-        MmmRectangle rect = {mmm_get_x (client->mmm), mmm_get_y (client->mmm),
-                             mmm_get_width (client->mmm), mmm_get_height        (client->mmm)};
-        host_queue_draw (host, &rect);
-        // fprintf (stderr, "client might be dead.. \n");
+        MmmRectangle clipped = {x0, y0, x1 - x0, y1 - y0};
+        client->visible[0] = clipped;
+        client->visible_count = 1;
       }
     }
+
+    for (j = 0; j < occluder_count && client->visible_count; j++)
+      client_occlude (client, &occluders[j]);
+
+    client->occluded = (client->visible_count == 0);
+    if (client->occluded != was_occluded)
+      mmm_add_event (client->mmm, client->occluded ? "visibility hidden" :
+                                                     "visibility visible");
+
+    if (rect.width > 0 && rect.height > 0 && !client->translucent)
+      occluders[occluder_count++] = rect;
   }
-  return 1;
+
+  free (occluders);
 }
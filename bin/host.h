@@ -16,26 +16,116 @@ OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
 #ifndef HOST_H
 #define HOST_H
 
-#include "mmm-list.h"
+#include <stdint.h>
 
 typedef struct _Client    Client;
 typedef struct _Host      Host;
 
+/* maximum number of rectangles kept for the visible part of a client, when
+ * more would be needed the visible region is approximated conservatively.
+ */
+#define HOST_MAX_VISIBLE 16
+
+/* number of cells along each axis of the hit-testing grid */
+#define HOST_GRID_SIZE   16
+
+/* milliseconds between checks for damage of clients that have to be
+ * polled, since they do not ring the doorbell
+ */
+#define HOST_POLL_INTERVAL 10
+
+/* milliseconds between checks for the exit of clients without a pidfd */
+#define HOST_REAP_INTERVAL 500
+
+/* times a new file is looked at, with doubling intervals from
+ * HOST_POLL_INTERVAL, before it is ignored until it changes again
+ */
+#define HOST_PENDING_TRIES 10
+
+/* what a file descriptor in the epoll set of the host is */
+typedef enum {
+  HOST_WATCH_DIR,     /* inotify on fbdir                  */
+  HOST_WATCH_CLIENT,  /* pidfd of a client, data is Client */
+  HOST_WATCH_DOORBELL,/* fifo clients write their slot to  */
+  HOST_WATCH_INPUT    /* an input device                   */
+} HostWatchType;
+
+typedef struct _HostWatch
+{
+  HostWatchType type;
+  void         *data;
+} HostWatch;
+
+typedef struct _HostPending
+{
+  char    *name;
+  int      tries;  /* HOST_PENDING_TRIES when given up on */
+  int64_t  next;   /* mmm_ticks of the next look */
+} HostPending;
+
 struct _Client
 {
   char *filename;
   Mmm  *mmm;
   long  pid;
+  int   pidfd;   /* readable once the client has exited, -1 if unsupported */
+  HostWatch watch;
+  int   doorbell; /* slot in Host.slots, 0 when polled for damage */
+  int   rung;     /* queued in Host.rung */
+
+  /* copy of the last content read, see host-composite.h */
+  uint8_t *cache;
+  int      cache_width;
+  int      cache_height;
+  int      cache_stride;
+  int      cache_stale;  /* frames were skipped, copy everything next read */
+  int      stalls;       /* times the client was busy when we wanted to read,
+                            published in .stats */
+  int      copy_applied; /* the copy of the frame to be read is in the cache */
 
   int  premax_x;
   int  premax_y;
   int  premax_width;
   int  premax_height;
+
+  /* geometry as of the last visibility computation, in host coordinates */
+  int  x;
+  int  y;
+  int  z;
+  int  width;    /* the size covered on screen, after scaling */
+  int  height;
+  int  serial;   /* order of addition, breaks ties in z */
+  float scale;         /* the "scale" value, see host-scale.h */
+  int   scale_filter;  /* HostScaleFilter from "scale-filter" */
+
+  int           occluded;       /* fully covered by opaque clients above */
+  int           translucent;    /* has set the "alpha" value, its pixels are
+                                   premultiplied and blended over what is
+                                   beneath it */
+  int           visible_count;  /* number of rectangles in visible       */
+  MmmRectangle  visible[HOST_MAX_VISIBLE];
+
+  /* tag of the last frame read, until it is presented - see host-trace.h */
+  int64_t       trace_input_time;
+  int64_t       trace_frame_time;
+
+  long          stats_render; /* microseconds rendering it, see host-stats.h */
+  float         render_ms;    /* per frame, as last published */
 };
+typedef struct _HostCell
+{
+  Client     **clients;  /* clients overlapping the cell, bottom-most first */
+  int          count;
+  int          alloc;
+} HostCell;
+
 struct _Host
 {
   char        *fbdir;
-  MmmList     *clients;
+  Client     **clients;      /* sorted on z, bottom-most first */
+  int          client_count;
+  int          client_alloc;
+  HostCell    *grid;         /* HOST_GRID_SIZE² cells covering the screen */
   Client      *focused;
   int          fullscreen;
   int          dirty_xmin;
@@ -55,6 +145,41 @@ struct _Host
   int          pointer_down[8];
 
   int          single_app;
+  int          stacking_changed; /* clients added/removed/restacked */
+
+  /* pixel format of the client caches, the native format of the host;
+   * cache_convert converts count client pixels starting at x, y in the
+   * client - by default caches are kept as 4 byte client pixels.
+   */
+  int          cache_bpp;
+  void       (*cache_convert) (Host *host, uint8_t *dst, const uint8_t *src,
+                               int x, int y, int count);
+
+  /* clients can move pixels with mmm_copy_rect rather than damaging them
+   * when copy_rects is set, the copies are applied to the client caches.
+   * copy_rect does the same with what is shown, for rect in host
+   * coordinates, returning 0 if it cannot - the destination is then
+   * redrawn.
+   */
+  int          copy_rects;
+  int        (*copy_rect) (Host *host, Client *client,
+                           const MmmRectangle *rect, int dx, int dy);
+
+  int          monitoring;    /* watches set up and fbdir scanned */
+  int          inotify_fd;    /* watching fbdir, -1 when falling back to scans */
+  int          watch_fd;      /* epoll set of inotify_fd, client pidfds and input */
+  HostWatch    dir_watch;
+
+  int          doorbell_fd;   /* fifo in fbdir clients ring with new damage */
+  HostWatch    doorbell_watch;
+  Client     **slots;         /* clients by doorbell slot */
+  int          slot_alloc;
+  Client     **rung;          /* clients that rang since the last check */
+  int          rung_count;
+  int          rung_alloc;
+  int          polled_count;  /* clients without a doorbell slot */
+  HostPending *pending;       /* new files not yet valid clients */
+  int          pending_count;
 };
 
 void host_clear_dirt  (Host *host);
@@ -62,8 +187,40 @@ void host_add_dirt    (Host *host, int x0, int y0, int x1, int y1);
 void validate_client  (Host *host, const char *client_name);
 void host_queue_draw  (Host *host, MmmRectangle *rect);
 void host_monitor_dir (Host *host);
+
+/* waits up to timeout milliseconds, -1 for no limit, for input or changes
+ * among the clients - shortened when clients have to be polled. Processes
+ * arriving and departing clients and returns non-0 if an input device
+ * registered with host_watch_fd is readable.
+ */
+int  host_wait          (Host *host, int timeout);
+void host_watch_fd      (Host *host, int fd);
+/* the epoll fd waited on by host_wait, for integration in other loops */
+int  host_get_fd        (Host *host);
+/* milliseconds until clients need to be checked again, -1 if never */
+int  host_poll_interval (Host *host);
 int  host_idle_check  (void *data);
 int  host_is_dirty    (Host *host);
+int  host_dirt_is_translucent (Host *host);
+void host_client_add_event (Host *host, Client *client, const char *event);
+/* with the time the input happened in mmm_timestamp () microseconds, 0
+ * when unknown
+ */
+void host_client_add_event_at (Host *host, Client *client, const char *event,
+                               int64_t time);
+void host_update_visibility (Host *host);
+void host_window_raise (Host *host, Client *focused);
+
+/* hit-test for the top-most client at x, y - returns NULL if none */
+Client *host_client_at      (Host *host, int x, int y);
+/* give focus to the client under the pointer, unless in single_app mode */
+void    host_pointer_focus  (Host *host, int x, int y);
+/* same, from the coordinates of a "mouse-*" event string */
+void    host_event_focus    (Host *host, const char *event);
+
+/* for threads other than the main thread iterating the clients */
+void host_lock_clients   (Host *host);
+void host_unlock_clients (Host *host);
 
 extern int host_has_quit;
 extern int host_width;
@@ -34,7 +34,17 @@ OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
 #include <sys/time.h>
 #include <sys/stat.h>
 
+#include "mxcfb.h"
+
 #include "host.h"
+#include "host-composite.h"
+#include "host-trace.h"
+#include "host-stats.h"
+#include "host-cursor.h"
+#include "host-bands.h"
+#include "host-scale.h"
+#include "host-rotate.h"
+#include "host-convert.h"
 
 #include "linux-evsource.h"
 
@@ -42,7 +52,9 @@ OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
 #define __KOBO_H__
 
 void kobo_brightness (int brightness);
-void kobo_eink_update_partial (int fb_fd, int mono, int left, int top, int width, int height);
+void kobo_eink_update (int fb_fd, uint32_t marker, int waveform, int full,
+                       int left, int top, int width, int height);
+void kobo_eink_wait (int fb_fd, uint32_t marker);
 void kobo_set_led_rgb (int red, int green, int blue);
 
 #endif
@@ -53,6 +65,27 @@ EvSource *evsource_kb_new (void);
 EvSource *evsource_mice_new (void);
 
 typedef struct _HostLinux   HostLinux;
+typedef struct _EinkUpdate  EinkUpdate;
+
+#define KOBO_EINK_PENDING   16 /* damaged rectangles gathered in a frame */
+#define KOBO_EINK_INFLIGHT  8  /* updates the EPDC may still be working on */
+#define KOBO_EINK_ANIMATING 300000 /* us between updates of animated content */
+#define KOBO_EINK_FLASH     64 /* ghosting allowed before a full refresh */
+
+/* what a damaged region holds, in increasing need of waveform levels */
+typedef enum {
+  EINK_MONO,       /* only black and white */
+  EINK_FEW_GRAYS,  /* up to four distinct levels */
+  EINK_GRAYS
+} EinkContent;
+
+struct _EinkUpdate
+{
+  MmmRectangle rect;
+  EinkContent  content;
+  uint32_t     marker;
+  long         time;
+};
 
 /////////////////////////////////////////////////////////////////////
 
@@ -70,6 +103,22 @@ struct _HostLinux
   int          fb_mapped_size;
   struct       fb_var_screeninfo vinfo;
   struct       fb_fix_screeninfo finfo;
+  HostCursor   cursor;
+  HostConvert  convert;
+  int          rotation;     /* of the display, clockwise; MMM_ROTATE */
+  EvSource    *ts;
+
+  /* damage of the frame being drawn, in display coordinates, and the
+   * updates submitted but not yet waited for, oldest first
+   */
+  EinkUpdate   eink_pending[KOBO_EINK_PENDING];
+  int          eink_pending_count;
+  EinkUpdate   eink_inflight[KOBO_EINK_INFLIGHT];
+  int          eink_inflight_count;
+  uint32_t     eink_marker;
+  int          eink_ghosting;  /* weighted count of fast updates since the
+                                  last full refresh */
+  int          eink_flash;     /* limit for the above, MMM_EINK_FLASH */
 
 
   EvSource    *evsource[4];
@@ -90,6 +139,7 @@ static int host_add_evsource (Host *host, EvSource *source)
   if (source)
   {
     host_linux->evsource[host_linux->evsource_count++] = source;
+    host_watch_fd (host, evsource_get_fd (source));
   }
   return 0;
 }
@@ -178,6 +228,27 @@ static int configure_vt (void)
   return 0;
 }
 
+/* touch events are in display coordinates, map them to the logical screen */
+static char *rotate_event (Host *host, char *event)
+{
+  HostLinux *host_linux = (void*)host;
+  char *rest = strchr (event, ' ');
+  char *rotated;
+  float x, y;
+  int len;
+
+  if (!rest || sscanf (rest, "%f %f%n", &x, &y, &len) < 2)
+    return event;
+
+  host_rotate_point (host_linux->rotation, host_linux->vinfo.xres,
+                     host_linux->vinfo.yres, &x, &y);
+  rotated = malloc (strlen (event) + 32);
+  sprintf (rotated, "%.*s %.0f %.0f%s", (int)(rest - event), event, x, y,
+           rest + len);
+  free (event);
+  return rotated;
+}
+
 static int event_check_pending (Host *host)
 {
   HostLinux *host_linux = (void*)host;
@@ -188,14 +259,24 @@ static int event_check_pending (Host *host)
     while (evsource_has_event (host_linux->evsource[i]))
     {
       char *event = evsource_get_event (host_linux->evsource[i]);
+      if (event && host_stats_hud_event (host, event))
+      {
+        free (event);
+        continue;
+      }
+      if (event && host_linux->rotation &&
+          host_linux->evsource[i] == host_linux->ts)
+        event = rotate_event (host, event);
       if (event)
       {
+        host_event_focus (host, event);
         if (host->focused)
         {
-          mmm_add_event (host->focused->mmm, event);
-          free (event);
+          host_client_add_event_at (host, host->focused, event,
+                                    host_linux->evsource[i]->time);
           had_event ++;
         }
+        free (event);
       }
     }
   }
@@ -203,296 +284,510 @@ static int event_check_pending (Host *host)
   return had_event != 0;
 }
 
-static inline void memcpy32_16 (uint8_t *dst, const uint8_t *src, int count)
+void _mmm_get_coords (Mmm *mmm, double *x, double *y);
+
+
+/* converts a row of client pixels to the fb pixel format, used when
+ * updating the client caches
+ */
+static void convert_row (Host *host, uint8_t *dst, const uint8_t *src,
+                         int x, int y, int count)
 {
-  while (count--)
-    {
-      int big = ((src[0] >> 3)) +
-                ((src[1] >> 2)<<5) +
-                ((src[2] >> 3)<<11);
-      dst[1] = big >> 8;
-      dst[0] = big & 255;
-      dst+=2;
-      src+=4;
-    }
+  HostLinux *host_linux = (void*)host;
+  host_convert_row (&host_linux->convert, dst, src, x, y, count);
 }
 
-static inline void memcpy32_15 (uint8_t *dst, const uint8_t *src, int count)
+static int rect_intersects (const MmmRectangle *a, const MmmRectangle *b)
 {
-  while (count--)
-    {
-      int big = ((src[2] >> 3)) +
-                ((src[1] >> 3)<<5) +
-                ((src[0] >> 3)<<10);
-      dst[1] = big >> 8;
-      dst[0] = big & 255;
-      dst+=2;
-      src+=4;
-    }
+  return a->x < b->x + b->width  && b->x < a->x + a->width &&
+         a->y < b->y + b->height && b->y < a->y + a->height;
 }
 
-static inline void memcpy32_8 (uint8_t *dst, const uint8_t *src, int count)
+/* overlapping or sharing an edge, such that the union covers no more
+ * than the two do
+ */
+static int rect_touches (const MmmRectangle *a, const MmmRectangle *b)
 {
-  while (count--)
-    {
-      dst[0] = ((src[0] >> 5)) +
-               ((src[1] >> 5)<<3) +
-               ((src[2] >> 6)<<6);
-      dst+=1;
-      src+=4;
-    }
+  return a->x <= b->x + b->width  && b->x <= a->x + a->width &&
+         a->y <= b->y + b->height && b->y <= a->y + a->height;
 }
 
-static inline void memcpy32_24 (uint8_t *dst, const uint8_t *src, int count)
+static void rect_union (MmmRectangle *a, const MmmRectangle *b)
 {
-  while (count--)
-    {
-      dst[0] = src[0];
-      dst[1] = src[1];
-      dst[2] = src[2];
-      dst+=3;
-      src+=4;
-    }
+  int x1 = a->x + a->width;
+  int y1 = a->y + a->height;
+
+  if (b->x + b->width > x1)  x1 = b->x + b->width;
+  if (b->y + b->height > y1) y1 = b->y + b->height;
+  if (b->x < a->x) a->x = b->x;
+  if (b->y < a->y) a->y = b->y;
+  a->width = x1 - a->x;
+  a->height = y1 - a->y;
 }
 
-void _mmm_get_coords (Mmm *mmm, double *x, double *y);
-
-#if 0
-static uint8_t cursor[16][16]={
-{1,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
-{1,2,1,1,0,0,0,0,0,0,0,0,0,0,0,0},
-{0,1,2,2,1,1,0,0,0,0,0,0,0,0,0,0},
-{0,1,2,2,2,2,1,1,0,0,0,0,0,0,0,0},
-{0,0,1,2,2,2,2,2,1,1,0,0,0,0,0,0},
-{0,0,1,2,2,2,2,2,2,2,1,1,0,0,0,0},
-{0,0,0,1,2,2,2,2,2,2,2,2,1,1,0,0},
-{0,0,0,1,2,2,2,2,1,1,1,1,1,1,1,1},
-{0,0,0,0,1,2,2,1,0,0,0,0,0,0,0,0},
-{0,0,0,0,1,2,2,1,0,0,0,0,0,0,0,0},
-{0,0,0,0,0,1,2,1,0,0,0,0,0,0,0,0},
-{0,0,0,0,0,1,2,1,0,0,0,0,0,0,0,0},
-{0,0,0,0,0,0,1,1,0,0,0,0,0,0,0,0},
-{0,0,0,0,0,0,1,1,0,0,0,0,0,0,0,0},
-{0,0,0,0,0,0,0,1,0,0,0,0,0,0,0,0},
-{0,0,0,0,0,0,0,1,0,0,0,0,0,0,0,0}};
-
-#else
-
-static uint8_t cursor[16][16]={
-{1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
-{1,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
-{1,2,1,0,0,0,0,0,0,0,0,0,0,0,0,0},
-{1,2,2,1,0,0,0,0,0,0,0,0,0,0,0,0},
-{1,2,2,2,1,0,0,0,0,0,0,0,0,0,0,0},
-{1,2,2,2,2,1,0,0,0,0,0,0,0,0,0,0},
-{1,2,2,2,2,2,1,0,0,0,0,0,0,0,0,0},
-{1,2,2,2,2,2,2,1,0,0,0,0,0,0,0,0},
-{1,2,2,2,2,2,2,2,1,0,0,0,0,0,0,0},
-{1,2,2,2,2,2,2,2,1,1,0,0,0,0,0,0},
-{1,2,2,2,2,2,1,1,0,0,0,0,0,0,0,0},
-{1,2,2,2,2,2,1,0,0,0,0,0,0,0,0,0},
-{1,2,1,1,2,2,1,0,0,0,0,0,0,0,0,0},
-{1,1,0,1,2,2,2,1,0,0,0,0,0,0,0,0},
-{0,0,0,0,1,2,2,1,0,0,0,0,0,0,0,0},
-{0,0,0,0,1,1,1,0,0,0,0,0,0,0,0,0}};
-
-#endif
+static inline uint32_t read_pixel (const uint8_t *p, int bpp)
+{
+  switch (bpp)
+  {
+    case 1: return p[0];
+    case 2: return p[0] | (p[1] << 8);
+    case 3: return p[0] | (p[1] << 8) | (p[2] << 16);
+    default: return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+  }
+}
 
-static void render_client (Host *host, Client *client, float ptr_x, float ptr_y)
+/* look at the fb format pixels of a region to find out which waveforms
+ * can show it, stops as soon as it has seen more than four levels
+ */
+static EinkContent eink_classify (const uint8_t *pixels, int stride, int bpp,
+                                  int width, int height)
 {
-  HostLinux *host_linux = (void*)host;
-  //SDL_Surface *screen = host_linux->screen;
-  int width, height, rowstride;
-  const unsigned char *pixels;
+  uint32_t white = bpp >= 3 ? 0xffffff : (1u << (bpp * 8)) - 1;
+  uint32_t mask = bpp >= 3 ? 0xffffff : white;
+  uint32_t levels[4];
+  int level_count = 0;
+  int mono = 1;
+  int u, v, i;
+
+  for (v = 0; v < height; v++)
+  {
+    const uint8_t *p = pixels + v * stride;
+    for (u = 0; u < width; u++, p += bpp)
+    {
+      uint32_t value = read_pixel (p, bpp) & mask;
 
-  if (client->pid == getpid ())
-    return;
+      if (level_count && value == levels[0])
+        continue;
+      for (i = 1; i < level_count; i++)
+        if (levels[i] == value)
+          break;
+      if (i < level_count)
+        continue;
+      if (level_count == 4)
+        return EINK_GRAYS;
+      levels[level_count++] = value;
+      if (value != 0 && value != white)
+        mono = 0;
+    }
+  }
+  return mono ? EINK_MONO : EINK_FEW_GRAYS;
+}
 
-  int cwidth, cheight;
-  int x = mmm_get_x (client->mmm);
-  int y = mmm_get_y (client->mmm);
+/* note that a rectangle of the logical screen changed, it is refreshed on
+ * the panel by eink_flush at the end of the frame
+ */
+static void eink_add_damage (HostLinux *host_linux,
+                             int x, int y, int width, int height,
+                             EinkContent content)
+{
+  EinkUpdate rect;
+  int i;
 
-  if (y > host->dirty_ymax ||
-      x > host->dirty_xmax)
+  if (host_linux->rotation)
+    host_rotate_box (host_linux->rotation,
+                     host_linux->vinfo.xres, host_linux->vinfo.yres,
+                     &x, &y, &width, &height);
+  if (x < 0) { width += x; x = 0; }
+  if (y < 0) { height += y; y = 0; }
+  if (x + width > (int)host_linux->vinfo.xres)
+    width = host_linux->vinfo.xres - x;
+  if (y + height > (int)host_linux->vinfo.yres)
+    height = host_linux->vinfo.yres - y;
+  if (width <= 0 || height <= 0)
     return;
 
-  pixels = mmm_get_buffer_read (client->mmm, &width, &height, &rowstride);
+  rect.rect.x = x;
+  rect.rect.y = y;
+  rect.rect.width = width;
+  rect.rect.height = height;
+  rect.content = content;
+
+  /* fold in the pending rectangles this touches, the union can reach
+   * further ones so start over after each merge
+   */
+  i = 0;
+  while (i < host_linux->eink_pending_count)
+  {
+    EinkUpdate *pending = &host_linux->eink_pending[i];
+    if (rect_touches (&pending->rect, &rect.rect))
+    {
+      rect_union (&rect.rect, &pending->rect);
+      if (pending->content > rect.content)
+        rect.content = pending->content;
+      host_linux->eink_pending[i] =
+        host_linux->eink_pending[--host_linux->eink_pending_count];
+      i = 0;
+    }
+    else
+      i++;
+  }
 
-  if (ptr_x >= x && ptr_x < x + width &&
-      ptr_y >= y && ptr_y < y + height)
+  if (host_linux->eink_pending_count == KOBO_EINK_PENDING)
+  {
+    for (i = 0; i < host_linux->eink_pending_count; i++)
     {
-      host->focused = client;
+      rect_union (&rect.rect, &host_linux->eink_pending[i].rect);
+      if (host_linux->eink_pending[i].content > rect.content)
+        rect.content = host_linux->eink_pending[i].content;
     }
+    host_linux->eink_pending_count = 0;
+  }
+  host_linux->eink_pending[host_linux->eink_pending_count++] = rect;
+}
 
-  if (pixels && width && height)
+static void eink_retire (HostLinux *host_linux, int no)
+{
+  kobo_eink_wait (host_linux->fb_fd, host_linux->eink_inflight[no].marker);
+  host_linux->eink_inflight_count--;
+  memmove (&host_linux->eink_inflight[no], &host_linux->eink_inflight[no + 1],
+           (host_linux->eink_inflight_count - no) * sizeof (EinkUpdate));
+}
+
+/* the damage under and of the cursor, which is black and white on top of
+ * whatever it was drawn over
+ */
+static void eink_cursor_damage (HostLinux *host_linux)
+{
+  HostCursor *cursor = &host_linux->cursor;
+
+  eink_add_damage (host_linux, cursor->backup_x0, cursor->backup_y0,
+                   cursor->backup_x1 - cursor->backup_x0,
+                   cursor->backup_y1 - cursor->backup_y0,
+                   eink_classify (cursor->backup,
+                                  HOST_CURSOR_SIZE * cursor->bpp, cursor->bpp,
+                                  cursor->backup_x1 - cursor->backup_x0,
+                                  cursor->backup_y1 - cursor->backup_y0));
+}
+
+/* pick the waveform for an update: DU takes any level to black or white
+ * quickly, A2 is faster still but only between black and white, so it is
+ * kept for regions that were black and white a moment ago as well - the
+ * frames of an animation or of scrolling text. GC4 and GC16 cover the
+ * rest.
+ */
+static int eink_waveform (HostLinux *host_linux, EinkUpdate *update)
+{
+  int i;
+
+  switch (update->content)
   {
-    int front_offset = y * host->stride + x * host->bpp;
-    uint8_t *dst = host_linux->front_buffer + front_offset;
-    const uint8_t *src = pixels;
-    int copy_count;
+    case EINK_MONO:
+      for (i = 0; i < host_linux->eink_inflight_count; i++)
+      {
+        EinkUpdate *prev = &host_linux->eink_inflight[i];
+        if (prev->content == EINK_MONO &&
+            update->time - prev->time < KOBO_EINK_ANIMATING &&
+            rect_intersects (&prev->rect, &update->rect))
+          return WAVEFORM_MODE_A2;
+      }
+      return WAVEFORM_MODE_DU;
+    case EINK_FEW_GRAYS:
+      return WAVEFORM_MODE_GC4;
+    default:
+      return WAVEFORM_MODE_GC16;
+  }
+}
+
+static void eink_retire_all (HostLinux *host_linux)
+{
+  while (host_linux->eink_inflight_count)
+    eink_retire (host_linux, 0);
+}
 
-    int start_scan;
-    int end_scan;
-    int scan;
+/* submit the damage of the frame, the EPDC works on updates of disjoint
+ * regions concurrently, so we only wait for the in flight updates a new
+ * one collides with - or the oldest when all slots are taken.
+ *
+ * Fast waveforms leave ghosts of what was shown before, once enough of
+ * them have been used, and nothing is animating, the next frame is shown
+ * with a flashing full refresh of the whole panel instead.
+ */
+static void eink_flush (HostLinux *host_linux)
+{
+  long now = mmm_ticks ();
+  int i, j;
 
-    start_scan = y;
-    end_scan = y + height;
+  if (!host_linux->eink_pending_count)
+    return;
 
-    if (end_scan < host->dirty_ymin ||
-        x + width < host->dirty_xmin)
+  if (host_linux->eink_flash &&
+      host_linux->eink_ghosting >= host_linux->eink_flash)
+  {
+    int animating = 0;
+    for (i = 0; i < host_linux->eink_inflight_count; i++)
+      if (now - host_linux->eink_inflight[i].time < KOBO_EINK_ANIMATING)
+        animating = 1;
+    if (!animating)
     {
-      mmm_read_done (client->mmm);
+      eink_retire_all (host_linux);
+      if (++host_linux->eink_marker == 0)
+        host_linux->eink_marker = 1;
+      kobo_eink_update (host_linux->fb_fd, host_linux->eink_marker,
+                        WAVEFORM_MODE_GC16, 1, 0, 0,
+                        host_linux->vinfo.xres, host_linux->vinfo.yres);
+      host_linux->eink_inflight[0].rect.x = 0;
+      host_linux->eink_inflight[0].rect.y = 0;
+      host_linux->eink_inflight[0].rect.width = host_linux->vinfo.xres;
+      host_linux->eink_inflight[0].rect.height = host_linux->vinfo.yres;
+      host_linux->eink_inflight[0].content = EINK_GRAYS;
+      host_linux->eink_inflight[0].marker = host_linux->eink_marker;
+      host_linux->eink_inflight[0].time = now;
+      host_linux->eink_inflight_count = 1;
+      host_linux->eink_pending_count = 0;
+      host_linux->eink_ghosting = 0;
       return;
     }
+  }
 
-    if (start_scan < host->dirty_ymin)
-      start_scan = host->dirty_ymin;
-    if (end_scan > host->dirty_ymax)
-      end_scan = host->dirty_ymax;
-    start_scan -= y;
-    end_scan -= y;
-    
-    copy_count = host->width - x;
-    if (copy_count > width)
-    {
-      copy_count = width;
-    }
+  for (i = 0; i < host_linux->eink_pending_count; i++)
+  {
+    EinkUpdate *update = &host_linux->eink_pending[i];
+    int waveform;
 
-    if (host->dirty_xmin > x)
+    /* chosen before the colliding updates are retired, since those tell
+     * us if the region is animating
+     */
+    update->time = now;
+    waveform = eink_waveform (host_linux, update);
+
+    j = 0;
+    while (j < host_linux->eink_inflight_count)
     {
-      dst += host_linux->fb_bpp * (host->dirty_xmin - x);
-      src += host->bpp * (host->dirty_xmin - x);
-      copy_count -= (host->dirty_xmin - x);
+      if (rect_intersects (&host_linux->eink_inflight[j].rect, &update->rect))
+        eink_retire (host_linux, j);
+      else
+        j++;
     }
+    if (host_linux->eink_inflight_count == KOBO_EINK_INFLIGHT)
+      eink_retire (host_linux, 0);
 
-    if (host->dirty_xmin + copy_count > host->dirty_xmax)
+    /* markers are arbitrary, but 0 means none */
+    if (++host_linux->eink_marker == 0)
+      host_linux->eink_marker = 1;
+    update->marker = host_linux->eink_marker;
+    host_linux->eink_inflight[host_linux->eink_inflight_count++] = *update;
+
+    switch (waveform)
     {
-      copy_count = (host->dirty_xmax - host->dirty_xmin);
+      case WAVEFORM_MODE_A2:   host_linux->eink_ghosting += 4; break;
+      case WAVEFORM_MODE_GC16: break;
+      default:                 host_linux->eink_ghosting += 1; break;
     }
+    kobo_eink_update (host_linux->fb_fd, update->marker, waveform, 0,
+                      update->rect.x, update->rect.y,
+                      update->rect.width, update->rect.height);
+  }
+  host_linux->eink_pending_count = 0;
+}
 
-    dst += (host_linux->fb_stride) * start_scan;
-    src += (rowstride) * start_scan;
+typedef struct _BlitRows BlitRows;
 
-    switch (host_linux->fb_bits)
-     {
-       case 32:
-          for (scan = start_scan; scan < end_scan; scan ++)
-          {
-            if (dst >= (uint8_t*)host_linux->front_buffer &&
-                dst < ((uint8_t*)host_linux->front_buffer) + (host_linux->fb_stride * host->height) - copy_count * 4)
-            memcpy (dst, src, copy_count * 4);
-            dst += host_linux->fb_stride;
-            src += rowstride;
-          }
-          break;
-       case 24:
-          for (scan = start_scan; scan < end_scan; scan ++)
-          {
-            if (dst >= (uint8_t*)host_linux->front_buffer &&
-                dst < ((uint8_t*)host_linux->front_buffer) + (host_linux->fb_stride * host->height) - copy_count)
-            memcpy32_24 (dst, src, copy_count);
-            dst += host_linux->fb_stride;
-            src += rowstride;
-          }
-          break;
-       case 16:
-          for (scan = start_scan; scan < end_scan; scan ++)
-          {
-            if (dst >= (uint8_t*)host_linux->front_buffer &&
-                dst < ((uint8_t*)host_linux->front_buffer) + (host_linux->fb_stride * host->height) - copy_count)
-            memcpy32_16 (dst, src, copy_count);
-            dst += host_linux->fb_stride;
-            src += rowstride;
-          }
-          break;
-       case 15:
-          for (scan = start_scan; scan < end_scan; scan ++)
-          {
-            if (dst >= (uint8_t*)host_linux->front_buffer &&
-                dst < ((uint8_t*)host_linux->front_buffer) + (host_linux->fb_stride * host->height) - copy_count)
-            memcpy32_15 (dst, src, copy_count);
-            dst += host_linux->fb_stride;
-            src += rowstride;
-          }
-          break;
-       case 8:
-          for (scan = start_scan; scan < end_scan; scan ++)
-          {
-            if (dst >= (uint8_t*)host_linux->front_buffer &&
-                dst < ((uint8_t*)host_linux->front_buffer) + (host_linux->fb_stride * host->height) - copy_count)
-            memcpy32_8 (dst, src, copy_count);
-            dst += host_linux->fb_stride;
-            src += rowstride;
-          }
-          break;
-      }
-    }
-    mmm_read_done (client->mmm);
-  mmm_host_get_size (client->mmm, &cwidth, &cheight);
+struct _BlitRows
+{
+  uint8_t       *dst;
+  const uint8_t *src;
+  int            dst_stride;
+  int            src_stride;
+  int            copy_bytes;
+};
+
+static void blit_rows (void *data, int y0, int y1)
+{
+  BlitRows *rows = data;
+  uint8_t *dst = rows->dst + y0 * rows->dst_stride;
+  const uint8_t *src = rows->src + y0 * rows->src_stride;
+  int scan;
 
-  kobo_eink_update_partial (host_linux->fb_fd, 0/*mono*/, 0,0, host->width, host->height);
+  for (scan = y0; scan < y1; scan ++)
+  {
+    memcpy (dst, src, rows->copy_bytes);
+    dst += rows->dst_stride;
+    src += rows->src_stride;
+  }
 }
 
-/* drawing of the cursor should be separated from the blitting
- * maybe even copying from the frontbuffer the contents it
- * is overdrawing; (and undrawing the cursor before each flip)
+/* copy the part of a client cache, already in the fb pixel format, that is
+ * within the screen rectangle x0,y0 - x1,y1 to the front buffer.
  */
+static void blit_rect (Host *host, const uint8_t *pixels, int rowstride,
+                       int x, int y, int x0, int y0, int x1, int y1)
+{
+  HostLinux *host_linux = (void*)host;
+  int bpp = host_linux->fb_bpp;
+  BlitRows rows;
 
-static uint8_t cursor_backup[16*16*4];
-static int     cursor_backup_x = 0;
-static int     cursor_backup_y = 0;
+  host_stats_bytes ((long)(x1 - x0) * (y1 - y0) * bpp);
+  if (host_linux->rotation)
+  {
+    host_rotate_rect (host_linux->front_buffer, host_linux->fb_stride,
+                      host_linux->vinfo.xres, host_linux->vinfo.yres,
+                      pixels + (y0 - y) * rowstride + (x0 - x) * bpp,
+                      rowstride, bpp, host_linux->rotation,
+                      x0, y0, x1 - x0, y1 - y0);
+    return;
+  }
 
-void draw_cursor (Host *host, int ptr_x, int ptr_y)
-{ 
-  int u,v;
-  cursor_backup_x = ptr_x;
-  cursor_backup_y = ptr_y;
+  rows.dst = host_linux->front_buffer + y0 * host_linux->fb_stride + x0 * bpp;
+  rows.src = pixels + (y0 - y) * rowstride + (x0 - x) * bpp;
+  rows.dst_stride = host_linux->fb_stride;
+  rows.src_stride = rowstride;
+  rows.copy_bytes = (x1 - x0) * bpp;
+  host_bands_run (blit_rows, &rows, 0, y1 - y0, rows.copy_bytes);
+}
 
-  for (v = 0; v < 16; v ++)
-    if (v + ptr_y > 0 && v + ptr_y < host->height)
-      for (u = 0; u < 16; u ++)
-      {
-        if (u + ptr_x > 0 && u + ptr_x < host->width)
-        {
-          int o = host_linux->fb_stride * ((int)ptr_y+v) + host_linux->fb_bpp * ((int)(ptr_x)+u);
-          int i;
-          for (i = 0; i < host_linux->fb_bpp; i++)
-            cursor_backup[(v * 16 + u)*4 + i] = host_linux->front_buffer[o + i];
-
-          if (cursor[v][u] == 1)
-          {
-            for (i = 0; i < host_linux->fb_bpp; i++)
-              host_linux->front_buffer[o+i] = 255;
-          }
-          else if (cursor[v][u] == 2)
-          {
-            for (i = 0; i < host_linux->fb_bpp; i++)
-              host_linux->front_buffer[o+i] = 0;
-            if (host_linux->fb_bpp == 4)
-              host_linux->front_buffer[o+3] = 255;
-          }
-        }
-      }
+/* draw the part of a scaled client within x0,y0 - x1,y1 */
+static void scale_rect (Host *host, Client *client,
+                        const uint8_t *pixels, int rowstride,
+                        int width, int height, int x0, int y0, int x1, int y1)
+{
+  HostLinux *host_linux = (void*)host;
+  HostScale scale;
+
+  scale.src = pixels;
+  scale.src_stride = rowstride;
+  scale.src_width = width;
+  scale.src_height = height;
+  scale.bpp = host_linux->fb_bpp;
+  scale.x = client->x;
+  scale.y = client->y;
+  scale.scale = client->scale;
+  scale.filter = client->scale_filter;
+  scale.blend = 0;
+  host_stats_bytes ((long)(x1 - x0) * (y1 - y0) * scale.bpp);
+
+  if (host_linux->rotation)
+  {
+    /* scale into a logical copy of the rectangle, then rotate that */
+    int stride = (x1 - x0) * scale.bpp;
+    uint8_t *tmp = malloc (stride * (y1 - y0));
+
+    if (!tmp)
+      return;
+    scale.x -= x0;
+    scale.y -= y0;
+    host_scale_rect (&scale, tmp, stride, 0, 0, x1 - x0, y1 - y0);
+    host_rotate_rect (host_linux->front_buffer, host_linux->fb_stride,
+                      host_linux->vinfo.xres, host_linux->vinfo.yres,
+                      tmp, stride, scale.bpp, host_linux->rotation,
+                      x0, y0, x1 - x0, y1 - y0);
+    free (tmp);
+    return;
+  }
+  host_scale_rect (&scale, host_linux->front_buffer, host_linux->fb_stride, x0, y0, x1, y1);
 }
 
-void undraw_cursor (Host *host)
+/* the content of the part of a scaled client shown in x0,y0 - x1,y1, the
+ * bilinear filter makes grays of black and white edges
+ */
+static EinkContent scaled_content (HostLinux *host_linux, Client *client,
+                                   const uint8_t *pixels, int rowstride,
+                                   int width, int height,
+                                   int x0, int y0, int x1, int y1)
+{
+  int u0 = (x0 - client->x) / client->scale;
+  int v0 = (y0 - client->y) / client->scale;
+  int u1 = (x1 - client->x) / client->scale + 1;
+  int v1 = (y1 - client->y) / client->scale + 1;
+
+  if (client->scale_filter)
+    return EINK_GRAYS;
+  if (u1 > width)  u1 = width;
+  if (v1 > height) v1 = height;
+  if (u1 <= u0 || v1 <= v0)
+    return EINK_MONO;
+  return eink_classify (pixels + v0 * rowstride + u0 * host_linux->fb_bpp,
+                        rowstride, host_linux->fb_bpp, u1 - u0, v1 - v0);
+}
+
+/* the HUD is drawn in logical coordinates and blitted like a client */
+static void draw_hud (Host *host, MmmRectangle *hud)
 {
-  int u,v;
-  int ptr_x = cursor_backup_x;
-  int ptr_y = cursor_backup_y;
+  HostLinux *host_linux = (void*)host;
+  int stride = hud->width * host_linux->fb_bpp;
+  uint8_t *pixels = malloc (stride * hud->height);
+
+  if (!pixels)
+    return;
+  host_stats_hud_draw (host, pixels, stride);
+  blit_rect (host, pixels, stride, hud->x, hud->y, hud->x, hud->y,
+             hud->x + hud->width, hud->y + hud->height);
+  eink_add_damage (host_linux, hud->x, hud->y, hud->width, hud->height,
+                   EINK_MONO);
+  free (pixels);
+}
+
+static void render_client (Host *host, Client *client)
+{
+  HostLinux *host_linux = (void*)host;
+  int width, height, rowstride;
+  const unsigned char *pixels;
+  int x, y;
+  int i;
+
+  if (client->pid == getpid ())
+    return;
 
-  for (v = 0; v < 16; v ++)
-    if (v + ptr_y > 0 && v + ptr_y < host->height)
-      for (u = 0; u < 16; u ++)
+  x = client->x;
+  y = client->y;
+
+  if (client->occluded)
+  {
+    /* nothing of it is visible, acknowledge the frame without reading it,
+     * the buffer is read once some of it becomes visible again
+     */
+    host_client_skip (host, client);
+    return;
+  }
+
+  if (y > host->dirty_ymax ||
+      x > host->dirty_xmax)
+    return;
+
+  pixels = host_client_read (host, client, &width, &height, &rowstride);
+
+  if (pixels && width && height)
+  {
+    for (i = 0; i < client->visible_count; i++)
+    {
+      MmmRectangle *rect = &client->visible[i];
+      int x0 = rect->x;
+      int y0 = rect->y;
+      int x1 = rect->x + rect->width;
+      int y1 = rect->y + rect->height;
+
+      if (x0 < host->dirty_xmin) x0 = host->dirty_xmin;
+      if (y0 < host->dirty_ymin) y0 = host->dirty_ymin;
+      if (x1 > host->dirty_xmax) x1 = host->dirty_xmax;
+      if (y1 > host->dirty_ymax) y1 = host->dirty_ymax;
+      if (client->scale != 1.0f)
       {
-        if (u + ptr_x > 0 && u + ptr_x < host->width)
+        if (x1 > x + client->width)  x1 = x + client->width;
+        if (y1 > y + client->height) y1 = y + client->height;
+        if (x1 > x0 && y1 > y0)
         {
-          int o = host_linux->fb_stride * ((int)ptr_y+v) + host_linux->fb_bpp * ((int)(ptr_x)+u);
-          int i;
-          for (i = 0; i < host_linux->fb_bpp; i++)
-              host_linux->front_buffer[o + i] = cursor_backup[(v * 16 + u)*4 + i];
+          scale_rect (host, client, pixels, rowstride, width, height,
+                      x0, y0, x1, y1);
+          eink_add_damage (host_linux, x0, y0, x1 - x0, y1 - y0,
+                           scaled_content (host_linux, client, pixels,
+                                           rowstride, width, height,
+                                           x0, y0, x1, y1));
         }
+        continue;
       }
+      if (x1 > x + width)  x1 = x + width;
+      if (y1 > y + height) y1 = y + height;
+
+      if (x1 > x0 && y1 > y0)
+      {
+        blit_rect (host, pixels, rowstride, x, y, x0, y0, x1, y1);
+        eink_add_damage (host_linux, x0, y0, x1 - x0, y1 - y0,
+                         eink_classify (pixels + (y0 - y) * rowstride +
+                                        (x0 - x) * host_linux->fb_bpp,
+                                        rowstride, host_linux->fb_bpp,
+                                        x1 - x0, y1 - y0));
+      }
+    }
+  }
 }
 
 Host *host_linux_new (const char *path, int width, int height)
@@ -547,8 +842,11 @@ Host *host_linux_new (const char *path, int width, int height)
        free (host_linux);
        return NULL;
      }
-  host_width = host_linux->vinfo.xres;
-  host_height = host_linux->vinfo.yres;
+  host_linux->rotation = host_rotation_from_env ();
+  host_width = host_linux->rotation % 180 ? host_linux->vinfo.yres :
+                                            host_linux->vinfo.xres;
+  host_height = host_linux->rotation % 180 ? host_linux->vinfo.xres :
+                                             host_linux->vinfo.yres;
 
   if (width < 0)
   {
@@ -571,7 +869,7 @@ Host *host_linux_new (const char *path, int width, int height)
       host_linux->vinfo.green.length +
       host_linux->vinfo.blue.length;
 
-  else if (host_linux->fb_bits == 8)
+  else if (host_linux->fb_bits == 8 && !host_linux->vinfo.grayscale)
   {
     unsigned short red[256],  green[256],  blue[256];
     unsigned short original_red[256];
@@ -601,6 +899,20 @@ Host *host_linux_new (const char *path, int width, int height)
   }
   
   host_linux->fb_bpp = host_linux->vinfo.bits_per_pixel / 8;
+  host->cache_bpp = host_linux->fb_bpp;
+  host->cache_convert = convert_row;
+  /* moved pixels are neither converted nor dithered again, the panel is
+   * refreshed where they went as it would be for damage
+   */
+  host->copy_rects = 1;
+  /* the eink waveforms resolve 16 gray levels, dither down to those */
+  host_convert_init (&host_linux->convert, host_linux->fb_bits,
+                     host_linux->vinfo.grayscale != 0, 4);
+  host_cursor_init (&host_linux->cursor, host);
+
+  host_linux->eink_flash = KOBO_EINK_FLASH;
+  if (getenv ("MMM_EINK_FLASH"))
+    host_linux->eink_flash = atoi (getenv ("MMM_EINK_FLASH"));
 
   host_linux->fb_stride = host_linux->finfo.line_length;
   host_linux->fb_mapped_size = host_linux->finfo.smem_len;
@@ -609,15 +921,16 @@ Host *host_linux_new (const char *path, int width, int height)
 
   if (host->fullscreen)
   {
-    host->width = host_linux->vinfo.xres;
+    host->width = host_width;
     host->stride = host->width * host->bpp;
-    host->height = host_linux->vinfo.yres;
+    host->height = host_height;
   }
 
   host_clear_dirt (host);
 
   host_add_evsource (host, evsource_kb_new ());
-  host_add_evsource (host, evsource_ts_new ());
+  host_linux->ts = evsource_ts_new ();
+  host_add_evsource (host, host_linux->ts);
 
   return host;
 }
@@ -666,6 +979,7 @@ void linux_warp_cursor (Host *host, int x, int y)
 static int main_kobo (const char *path, int single)
 {
   Host *host;
+  int busy = 0;
 
   host = host_linux_new (path, -1, -1);
   host_linux = (void*) host;
@@ -677,18 +991,21 @@ static int main_kobo (const char *path, int single)
   {
     int got_event;
 
+    /* sleep until there is input, a change among the clients or they
+     * are due to be polled for damage - unless we just drew a frame.
+     */
+    host_wait (host, busy ? 0 : -1);
     got_event = event_check_pending (host);
     host_idle_check (host);
-    host_monitor_dir (host);
+    host_stats_messages (host);
 
-    if (got_event || (host_is_dirty (host) && host_linux->vt_active))
+    busy = got_event || (host_is_dirty (host) && host_linux->vt_active);
+    if (busy)
     {
       int warp = 0;
       double px, py;
-      MmmList *l;
-
-      if (!host->single_app)
-        host->focused = NULL;
+      int i;
+      long start;
 
       _mmm_get_coords (NULL, &px, &py);
 
@@ -703,23 +1020,62 @@ static int main_kobo (const char *path, int single)
 
       if (host_is_dirty (host))
       {
-        undraw_cursor (host);
-        for (l = host->clients; l; l = l->next)
+        MmmRectangle hud;
+
+        /* the HUD is drawn over whatever else changes */
+        host_stats_hud_rect (host, &hud);
+        if (host_stats_hud_shown ())
+          host_add_dirt (host, hud.x, hud.y,
+                         hud.x + hud.width, hud.y + hud.height);
+
+        host_update_visibility (host);
+        if (host_linux->cursor.shown)
+          eink_cursor_damage (host_linux);
+        start = mmm_ticks ();
+        host_cursor_undraw (&host_linux->cursor, host_linux->front_buffer,
+                            host_linux->fb_stride);
+        host_stats_add (HOST_STAT_CURSOR, mmm_ticks () - start);
+        for (i = 0; i < host->client_count; i++)
         {
-          render_client (host, l->data, px, py);
+          int64_t trace_start = mmm_trace_begin ();
+          start = mmm_ticks ();
+          render_client (host, host->clients[i]);
+          host_stats_client (host->clients[i], mmm_ticks () - start);
+          mmm_trace_end (trace_start, "render",
+                         mmm_get_title (host->clients[i]->mmm));
         }
+        if (host_stats_hud_shown ())
+          draw_hud (host, &hud);
         host_clear_dirt (host);
-        draw_cursor (host, px, py);
       }
-      else
+
+      /* the cursor is drawn in display coordinates, and left out on a
+       * rotated display where touch is the only pointer
+       */
+      if (!host_linux->rotation && (!host_linux->cursor.shown ||
+          host_linux->cursor.x != (int)px || host_linux->cursor.y != (int)py))
       {
-        undraw_cursor (host);
-        draw_cursor (host, px, py);
+        if (host_linux->cursor.shown)
+          eink_cursor_damage (host_linux);
+        start = mmm_ticks ();
+        host_cursor_undraw (&host_linux->cursor, host_linux->front_buffer,
+                            host_linux->fb_stride);
+        host_cursor_draw (&host_linux->cursor, host_linux->front_buffer,
+                          host_linux->fb_stride, host->width, host->height,
+                          px, py);
+        host_stats_add (HOST_STAT_CURSOR, mmm_ticks () - start);
+        eink_cursor_damage (host_linux);
       }
-    }
-    else
-    {
-      usleep (10000);
+      /* as submitted, the refresh of the panel itself takes longer */
+      {
+        int64_t trace_start = mmm_trace_begin ();
+        start = mmm_ticks ();
+        eink_flush (host_linux);
+        host_stats_add (HOST_STAT_PRESENT, mmm_ticks () - start);
+        mmm_trace_end (trace_start, "eink-flush", NULL);
+      }
+      host_trace_presented (host);
+      host_stats_frame (host);
     }
   }
   ioctl(host_linux->tty, KDSETMODE, KD_TEXT);
@@ -777,7 +1133,6 @@ int main (int argc, char **argv)
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
-#include "mxcfb.h"
 
 void kobo_brightness (int brightness)
 {
@@ -791,51 +1146,31 @@ void kobo_brightness (int brightness)
     close (fd);
 }
 
-void kobo_eink_update_partial (int fb_fd, int mono, int left, int top, int width, int height)
+void kobo_eink_update (int fb_fd, uint32_t marker, int waveform, int full,
+                       int left, int top, int width, int height)
 {
   struct mxcfb_update_data region;
-  static int prev_marker = 0;
-  static int marker = 1;
-  static int mono_no = 0;
-
-  marker ++;
-  if (marker > 100)
-    marker = 1;
-  if (prev_marker)
-    ioctl(fb_fd , MXCFB_WAIT_FOR_UPDATE_COMPLETE, prev_marker);
 
+  memset (&region, 0, sizeof (region));
   region.update_marker = marker; /* Marker used when waiting for completion */
   region.update_region.top = top;
   region.update_region.left = left;
   region.update_region.width = width;
   region.update_region.height = height;
-  // 1 is quite good and fast in bw
-  // 2 doesn't work
-  // 3 doesn't work
-  // 4 works
-
-  /* maybe switch to waveform 4 after having ensured stable bw?.. */
-
-  region.update_mode = UPDATE_MODE_PARTIAL;
-  //region.update_mode = UPDATE_MODE_FULL;
+  region.update_mode = full ? UPDATE_MODE_FULL : UPDATE_MODE_PARTIAL;
   region.temp = TEMP_USE_AMBIENT;
-  if (mono)
-    {
-      if (mono_no == 0)
-        region.waveform_mode = WAVEFORM_MODE_AUTO;
-      else
-        region.waveform_mode = 4;
-      region.flags = EPDC_FLAG_FORCE_MONOCHROME;
-      mono_no++;
-    }
-  else
-    {
-      region.waveform_mode = WAVEFORM_MODE_AUTO;
-      region.flags = 0;
-      mono_no = 0;
-    }
+  region.waveform_mode = waveform;
+  /* A2 leaves grays half way, snap those to black or white */
+  region.flags = waveform == WAVEFORM_MODE_A2 ? EPDC_FLAG_FORCE_MONOCHROME : 0;
   ioctl(fb_fd , MXCFB_SEND_UPDATE, &region);
-  prev_marker = marker;
+}
+
+/* block until the update with the given marker has been shown */
+void kobo_eink_wait (int fb_fd, uint32_t marker)
+{
+  long start = mmm_ticks ();
+  ioctl(fb_fd , MXCFB_WAIT_FOR_UPDATE_COMPLETE, &marker);
+  host_stats_add (HOST_STAT_EPDC_WAIT, mmm_ticks () - start);
 }
 
 void kobo_set_led_rgb (int red, int green, int blue)
@@ -0,0 +1,647 @@
+/*
+ * 2014 (c) Øyvind Kolås
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <linux/input.h>
+
+#include "mmm.h"
+#include "host.h"
+#include "host-rotate.h"
+#include "linux-evsource.h"
+
+/* keyboards and pointers read from the evdev nodes in /dev/input, devices
+ * are picked up and dropped as they come and go. All devices, and an
+ * inotify watch of the directory, are gathered in one epoll set that the
+ * host waits on, each wakeup reads whole batches of input_events.
+ *
+ * Keys give the same names as the terminal keyboard source on press and
+ * autorepeat, along with "key-down name" and "key-up name" for every
+ * press and release. Pointers yield one mouse event per frame, touch
+ * screens reporting only multi-touch positions are followed by their first
+ * touch, and absolute positions are mapped from the display as it is
+ * mounted to the rotated screen.
+ */
+
+#define EVDEV_MAX_DEVICES 16
+#define EVDEV_READ_BATCH  64
+#define EVDEV_QUEUE       256
+
+#define BITS_LONG         (sizeof (long) * 8)
+#define TEST_BIT(bits, n) ((bits[(n) / BITS_LONG] >> ((n) % BITS_LONG)) & 1)
+
+typedef struct EvdevDevice
+{
+  int    fd;
+  int    number;     /* N of /dev/input/eventN */
+  int    absolute;   /* tablets and touch screens */
+  int    multitouch; /* positions only in the ABS_MT axes, of slot 0 */
+  int    slot;       /* the multi-touch slot being reported */
+  struct input_absinfo abs_x;
+  struct input_absinfo abs_y;
+} EvdevDevice;
+
+typedef struct Evdev
+{
+  int          fd;     /* the epoll set */
+  double       x;      /* shared with _mmm_get_coords */
+  double       y;
+
+  int          inotify_fd;
+  EvdevDevice  device[EVDEV_MAX_DEVICES];
+  int          device_count;
+
+  int          rotation; /* of the display, clockwise */
+  int          buttons;
+  int          prev_buttons;
+  int          moved;
+  int          shift, control, alt, caps;
+
+  char        *queue[EVDEV_QUEUE];
+  int64_t      queue_time[EVDEV_QUEUE]; /* kernel time of the events */
+  int64_t      time;                    /* of the event being handled */
+  int          queue_head;
+  int          queue_tail;
+
+  int          have_termios;
+  struct termios orig_attr;
+} Evdev;
+
+static Evdev evdev;
+static Evdev *this = &evdev;
+
+static int has_event (void);
+static char *get_event (void);
+static void destroy (void);
+static int get_fd (EvSource *ev_source);
+static void set_coord (EvSource *ev_source, double x, double y);
+
+static EvSource ev_src_evdev = {
+  NULL,
+  (void*)has_event,
+  (void*)get_event,
+  (void*)destroy,
+  get_fd,
+  set_coord
+};
+
+extern void *_mrg_evsrc_coord;
+int is_active (Host *host);
+
+typedef struct EvdevKey
+{
+  const char *name;
+  const char *shifted;
+} EvdevKey;
+
+/* a us layout, named like the keys of the terminal keyboard source */
+static const EvdevKey keymap[KEY_MICMUTE + 1] = {
+  [KEY_ESC]        = {"escape", NULL},
+  [KEY_1]          = {"1", "!"},
+  [KEY_2]          = {"2", "@"},
+  [KEY_3]          = {"3", "#"},
+  [KEY_4]          = {"4", "$"},
+  [KEY_5]          = {"5", "%"},
+  [KEY_6]          = {"6", "^"},
+  [KEY_7]          = {"7", "&"},
+  [KEY_8]          = {"8", "*"},
+  [KEY_9]          = {"9", "("},
+  [KEY_0]          = {"0", ")"},
+  [KEY_MINUS]      = {"-", "_"},
+  [KEY_EQUAL]      = {"=", "+"},
+  [KEY_BACKSPACE]  = {"backspace", NULL},
+  [KEY_TAB]        = {"tab", NULL},
+  [KEY_Q]          = {"q", "Q"},
+  [KEY_W]          = {"w", "W"},
+  [KEY_E]          = {"e", "E"},
+  [KEY_R]          = {"r", "R"},
+  [KEY_T]          = {"t", "T"},
+  [KEY_Y]          = {"y", "Y"},
+  [KEY_U]          = {"u", "U"},
+  [KEY_I]          = {"i", "I"},
+  [KEY_O]          = {"o", "O"},
+  [KEY_P]          = {"p", "P"},
+  [KEY_LEFTBRACE]  = {"[", "{"},
+  [KEY_RIGHTBRACE] = {"]", "}"},
+  [KEY_ENTER]      = {"return", NULL},
+  [KEY_A]          = {"a", "A"},
+  [KEY_S]          = {"s", "S"},
+  [KEY_D]          = {"d", "D"},
+  [KEY_F]          = {"f", "F"},
+  [KEY_G]          = {"g", "G"},
+  [KEY_H]          = {"h", "H"},
+  [KEY_J]          = {"j", "J"},
+  [KEY_K]          = {"k", "K"},
+  [KEY_L]          = {"l", "L"},
+  [KEY_SEMICOLON]  = {";", ":"},
+  [KEY_APOSTROPHE] = {"'", "\""},
+  [KEY_GRAVE]      = {"`", "~"},
+  [KEY_BACKSLASH]  = {"\\", "|"},
+  [KEY_Z]          = {"z", "Z"},
+  [KEY_X]          = {"x", "X"},
+  [KEY_C]          = {"c", "C"},
+  [KEY_V]          = {"v", "V"},
+  [KEY_B]          = {"b", "B"},
+  [KEY_N]          = {"n", "N"},
+  [KEY_M]          = {"m", "M"},
+  [KEY_COMMA]      = {",", "<"},
+  [KEY_DOT]        = {".", ">"},
+  [KEY_SLASH]      = {"/", "?"},
+  [KEY_KPASTERISK] = {"*", NULL},
+  [KEY_SPACE]      = {"space", NULL},
+  [KEY_F1]         = {"F1", NULL},
+  [KEY_F2]         = {"F2", NULL},
+  [KEY_F3]         = {"F3", NULL},
+  [KEY_F4]         = {"F4", NULL},
+  [KEY_F5]         = {"F5", NULL},
+  [KEY_F6]         = {"F6", NULL},
+  [KEY_F7]         = {"F7", NULL},
+  [KEY_F8]         = {"F8", NULL},
+  [KEY_F9]         = {"F9", NULL},
+  [KEY_F10]        = {"F10", NULL},
+  [KEY_F11]        = {"F11", NULL},
+  [KEY_F12]        = {"F12", NULL},
+  [KEY_KP7]        = {"7", NULL},
+  [KEY_KP8]        = {"8", NULL},
+  [KEY_KP9]        = {"9", NULL},
+  [KEY_KPMINUS]    = {"-", NULL},
+  [KEY_KP4]        = {"4", NULL},
+  [KEY_KP5]        = {"5", NULL},
+  [KEY_KP6]        = {"6", NULL},
+  [KEY_KPPLUS]     = {"+", NULL},
+  [KEY_KP1]        = {"1", NULL},
+  [KEY_KP2]        = {"2", NULL},
+  [KEY_KP3]        = {"3", NULL},
+  [KEY_KP0]        = {"0", NULL},
+  [KEY_KPDOT]      = {".", NULL},
+  [KEY_KPENTER]    = {"return", NULL},
+  [KEY_KPSLASH]    = {"/", NULL},
+  [KEY_HOME]       = {"home", NULL},
+  [KEY_UP]         = {"up", NULL},
+  [KEY_PAGEUP]     = {"page-up", NULL},
+  [KEY_LEFT]       = {"left", NULL},
+  [KEY_RIGHT]      = {"right", NULL},
+  [KEY_END]        = {"end", NULL},
+  [KEY_DOWN]       = {"down", NULL},
+  [KEY_PAGEDOWN]   = {"page-down", NULL},
+  [KEY_INSERT]     = {"insert", NULL},
+  [KEY_DELETE]     = {"delete", NULL},
+  [KEY_LEFTSHIFT]  = {"shift", NULL},
+  [KEY_RIGHTSHIFT] = {"shift", NULL},
+  [KEY_LEFTCTRL]   = {"control", NULL},
+  [KEY_RIGHTCTRL]  = {"control", NULL},
+  [KEY_LEFTALT]    = {"alt", NULL},
+  [KEY_RIGHTALT]   = {"alt", NULL},
+  [KEY_CAPSLOCK]   = {"capslock", NULL},
+};
+
+static void queue_event (const char *event)
+{
+  int next = (this->queue_tail + 1) % EVDEV_QUEUE;
+
+  if (next == this->queue_head) /* full, drop the oldest */
+  {
+    free (this->queue[this->queue_head]);
+    this->queue_head = (this->queue_head + 1) % EVDEV_QUEUE;
+  }
+  this->queue[this->queue_tail] = strdup (event);
+  this->queue_time[this->queue_tail] = this->time;
+  this->queue_tail = next;
+}
+
+static void add_device (int number)
+{
+  unsigned long ev_bits[EV_MAX / BITS_LONG + 1] = {0};
+  unsigned long key_bits[KEY_MAX / BITS_LONG + 1] = {0};
+  unsigned long abs_bits[ABS_MAX / BITS_LONG + 1] = {0};
+  struct epoll_event event = {EPOLLIN, {0}};
+  EvdevDevice *device;
+  char path[64];
+  int keyboard, relative, absolute, multitouch;
+  int fd, i;
+
+  for (i = 0; i < this->device_count; i++)
+    if (this->device[i].number == number)
+      return;
+  if (this->device_count == EVDEV_MAX_DEVICES)
+    return;
+
+  sprintf (path, "/dev/input/event%i", number);
+  fd = open (path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  if (fd < 0)
+    return;
+
+  ioctl (fd, EVIOCGBIT (0, sizeof (ev_bits)), ev_bits);
+  ioctl (fd, EVIOCGBIT (EV_KEY, sizeof (key_bits)), key_bits);
+  ioctl (fd, EVIOCGBIT (EV_ABS, sizeof (abs_bits)), abs_bits);
+
+  keyboard = TEST_BIT (ev_bits, EV_KEY) && TEST_BIT (key_bits, KEY_A);
+  relative = TEST_BIT (ev_bits, EV_REL) && TEST_BIT (key_bits, BTN_LEFT);
+  /* most multi-touch screens also report the first touch on the single
+   * touch axes, those that do not are followed in slot 0
+   */
+  multitouch = !(TEST_BIT (abs_bits, ABS_X) && TEST_BIT (abs_bits, ABS_Y)) &&
+               TEST_BIT (abs_bits, ABS_MT_POSITION_X) &&
+               TEST_BIT (abs_bits, ABS_MT_POSITION_Y) &&
+               TEST_BIT (abs_bits, ABS_MT_TRACKING_ID);
+  absolute = TEST_BIT (ev_bits, EV_ABS) &&
+             ((TEST_BIT (abs_bits, ABS_X) && TEST_BIT (abs_bits, ABS_Y) &&
+               (TEST_BIT (key_bits, BTN_TOUCH) ||
+                TEST_BIT (key_bits, BTN_LEFT))) ||
+              multitouch);
+
+  if (!keyboard && !relative && !absolute)
+  {
+    close (fd);
+    return;
+  }
+
+  device = &this->device[this->device_count++];
+  memset (device, 0, sizeof (EvdevDevice));
+  device->fd = fd;
+  device->number = number;
+  device->absolute = absolute && !relative;
+  device->multitouch = device->absolute && multitouch;
+  if (device->multitouch)
+  {
+    struct input_absinfo slot = {0};
+    ioctl (fd, EVIOCGABS (ABS_MT_POSITION_X), &device->abs_x);
+    ioctl (fd, EVIOCGABS (ABS_MT_POSITION_Y), &device->abs_y);
+    ioctl (fd, EVIOCGABS (ABS_MT_SLOT), &slot);
+    device->slot = slot.value;
+  }
+  else if (device->absolute)
+  {
+    ioctl (fd, EVIOCGABS (ABS_X), &device->abs_x);
+    ioctl (fd, EVIOCGABS (ABS_Y), &device->abs_y);
+  }
+
+  event.data.ptr = device;
+  epoll_ctl (this->fd, EPOLL_CTL_ADD, fd, &event);
+}
+
+static void remove_device (EvdevDevice *device)
+{
+  int no = device - this->device;
+  int i;
+
+  epoll_ctl (this->fd, EPOLL_CTL_DEL, device->fd, NULL);
+  close (device->fd);
+  this->device_count--;
+  memmove (device, device + 1,
+           (this->device_count - no) * sizeof (EvdevDevice));
+  /* the epoll set refers to devices by address */
+  for (i = no; i < this->device_count; i++)
+  {
+    struct epoll_event event = {EPOLLIN, {.ptr = &this->device[i]}};
+    epoll_ctl (this->fd, EPOLL_CTL_MOD, this->device[i].fd, &event);
+  }
+}
+
+static void scan_devices (void)
+{
+  DIR *dir = opendir ("/dev/input");
+  struct dirent *entry;
+
+  if (!dir)
+    return;
+  while ((entry = readdir (dir)))
+    if (!strncmp (entry->d_name, "event", 5))
+      add_device (atoi (entry->d_name + 5));
+  closedir (dir);
+}
+
+static void handle_key (int code, int value)
+{
+  const EvdevKey *key;
+  char buf[64];
+  const char *name;
+
+  if (code < 0 || code > KEY_MICMUTE || !keymap[code].name)
+    return;
+  key = &keymap[code];
+
+  switch (code)
+  {
+    case KEY_LEFTSHIFT: case KEY_RIGHTSHIFT: this->shift = value != 0; break;
+    case KEY_LEFTCTRL:  case KEY_RIGHTCTRL:  this->control = value != 0; break;
+    case KEY_LEFTALT:   case KEY_RIGHTALT:   this->alt = value != 0; break;
+    case KEY_CAPSLOCK:  if (value == 1) this->caps = !this->caps; break;
+  }
+
+  if (value != 2)
+  {
+    snprintf (buf, sizeof (buf), "%s %s", value ? "key-down" : "key-up",
+              key->name);
+    queue_event (buf);
+  }
+  if (value == 0 ||
+      code == KEY_LEFTSHIFT || code == KEY_RIGHTSHIFT ||
+      code == KEY_LEFTCTRL || code == KEY_RIGHTCTRL ||
+      code == KEY_LEFTALT || code == KEY_RIGHTALT || code == KEY_CAPSLOCK)
+    return;
+
+  name = key->name;
+  if (key->shifted)
+  {
+    int upper = this->shift;
+    if (this->caps && key->name[0] >= 'a' && key->name[0] <= 'z')
+      upper = !upper;
+    if (upper && !this->control && !this->alt)
+      name = key->shifted;
+  }
+
+  /* modifiers prefix the names as in the terminal key table, shift only
+   * for keys that do not have a shifted character of their own
+   */
+  snprintf (buf, sizeof (buf), "%s%s%s%s",
+            this->control ? "control-" : "",
+            this->alt ? "alt-" : "",
+            this->shift && !key->shifted && strlen (name) > 1 ? "shift-" : "",
+            name);
+  queue_event (buf);
+}
+
+static void pointer_frame (void)
+{
+  char buf[64];
+  int changed = this->buttons ^ this->prev_buttons;
+
+  if (this->moved && !(changed & 1))
+  {
+    sprintf (buf, "%s %.0f %.0f",
+             this->buttons & 1 ? "mouse-drag" : "mouse-motion",
+             this->x, this->y);
+    queue_event (buf);
+  }
+  if (changed & 1)
+  {
+    sprintf (buf, "%s %.0f %.0f",
+             this->buttons & 1 ? "mouse-press" : "mouse-release",
+             this->x, this->y);
+    queue_event (buf);
+  }
+  this->prev_buttons = this->buttons;
+  this->moved = 0;
+}
+
+static float abs_scale (const struct input_absinfo *info, int size)
+{
+  if (info->maximum <= info->minimum)
+    return info->value;
+  return (info->value - info->minimum) * (float)size /
+         (info->maximum - info->minimum + 1);
+}
+
+/* the position on the display, as it is mounted, to the rotated screen */
+static void abs_position (EvdevDevice *device, Host *host)
+{
+  int phys_width = this->rotation % 180 ? host->height : host->width;
+  int phys_height = this->rotation % 180 ? host->width : host->height;
+  float x = abs_scale (&device->abs_x, phys_width);
+  float y = abs_scale (&device->abs_y, phys_height);
+
+  host_rotate_point (this->rotation, phys_width, phys_height, &x, &y);
+  this->x = x;
+  this->y = y;
+  this->moved = 1;
+}
+
+static void handle_event (EvdevDevice *device, const struct input_event *ev)
+{
+  Host *host = ev_src_evdev.priv;
+
+  this->time = ev->time.tv_sec * (int64_t)1000000 + ev->time.tv_usec;
+  switch (ev->type)
+  {
+    case EV_KEY:
+      if (ev->code == BTN_LEFT || ev->code == BTN_TOUCH)
+      {
+        if (ev->value) this->buttons |= 1;
+        else           this->buttons &= ~1;
+      }
+      else if (ev->code == BTN_RIGHT)
+      {
+        if (ev->value) this->buttons |= 2;
+        else           this->buttons &= ~2;
+      }
+      else
+        handle_key (ev->code, ev->value);
+      break;
+    case EV_REL:
+      if (ev->code == REL_X)      { this->x += ev->value; this->moved = 1; }
+      else if (ev->code == REL_Y) { this->y += ev->value; this->moved = 1; }
+      break;
+    case EV_ABS:
+      if (!device->absolute || !host)
+        break;
+      if (device->multitouch)
+      {
+        if (ev->code == ABS_MT_SLOT)
+          device->slot = ev->value;
+        else if (device->slot != 0)
+          break;
+        else if (ev->code == ABS_MT_TRACKING_ID)
+        {
+          if (ev->value >= 0) this->buttons |= 1;
+          else                this->buttons &= ~1;
+        }
+        else if (ev->code == ABS_MT_POSITION_X)
+        {
+          device->abs_x.value = ev->value;
+          abs_position (device, host);
+        }
+        else if (ev->code == ABS_MT_POSITION_Y)
+        {
+          device->abs_y.value = ev->value;
+          abs_position (device, host);
+        }
+      }
+      else if (ev->code == ABS_X)
+      {
+        device->abs_x.value = ev->value;
+        abs_position (device, host);
+      }
+      else if (ev->code == ABS_Y)
+      {
+        device->abs_y.value = ev->value;
+        abs_position (device, host);
+      }
+      break;
+    case EV_SYN:
+      if (ev->code == SYN_REPORT)
+        pointer_frame ();
+      break;
+  }
+}
+
+/* returns 1 when the device went away */
+static int read_device (EvdevDevice *device)
+{
+  struct input_event buf[EVDEV_READ_BATCH];
+  int rc, i;
+
+  while ((rc = read (device->fd, buf, sizeof (buf))) > 0)
+    for (i = 0; i < rc / (int)sizeof (struct input_event); i++)
+      handle_event (device, &buf[i]);
+  if (rc < 0 && errno == ENODEV) /* unplugged */
+  {
+    remove_device (device);
+    return 1;
+  }
+  return 0;
+}
+
+static void read_hotplug (void)
+{
+  char buf[1024];
+
+  /* rather than decoding the names, any change is followed by a rescan -
+   * nodes are created before udev makes them readable, so attribute
+   * changes are watched as well
+   */
+  while (read (this->inotify_fd, buf, sizeof (buf)) > 0);
+  scan_devices ();
+}
+
+/* reads whatever the devices have for us, without blocking */
+static void dispatch (void)
+{
+  struct epoll_event events[EVDEV_MAX_DEVICES + 1];
+  int count, i;
+
+  count = epoll_wait (this->fd, events, EVDEV_MAX_DEVICES + 1, 0);
+  for (i = 0; i < count; i++)
+  {
+    if (events[i].data.ptr == NULL)
+      read_hotplug ();
+    /* the remaining events may point at moved devices, they are still
+     * pending for the next round
+     */
+    else if (read_device (events[i].data.ptr))
+      break;
+  }
+  /* keys also reach the terminal, which is in raw mode; drop them there */
+  if (this->have_termios)
+    tcflush (STDIN_FILENO, TCIFLUSH);
+}
+
+static int has_event (void)
+{
+  if (this->queue_head != this->queue_tail)
+    return 1;
+  dispatch ();
+  return this->queue_head != this->queue_tail;
+}
+
+static char *get_event (void)
+{
+  char *event;
+
+  if (this->queue_head == this->queue_tail)
+    dispatch ();
+  if (this->queue_head == this->queue_tail)
+    return NULL;
+  event = this->queue[this->queue_head];
+  ev_src_evdev.time = this->queue_time[this->queue_head];
+  this->queue_head = (this->queue_head + 1) % EVDEV_QUEUE;
+
+  if (!is_active (ev_src_evdev.priv))
+  {
+    free (event);
+    return NULL;
+  }
+  return event;
+}
+
+static void restore_terminal (void)
+{
+  if (this->have_termios)
+    tcsetattr (STDIN_FILENO, TCSAFLUSH, &this->orig_attr);
+}
+
+static void destroy (void)
+{
+  restore_terminal ();
+  while (this->device_count)
+    remove_device (&this->device[0]);
+  if (this->inotify_fd >= 0)
+    close (this->inotify_fd);
+  close (this->fd);
+}
+
+static int get_fd (EvSource *ev_source)
+{
+  return this->fd;
+}
+
+static void set_coord (EvSource *ev_source, double x, double y)
+{
+  this->x = x;
+  this->y = y;
+}
+
+EvSource *evsource_evdev_new (int rotation)
+{
+  struct epoll_event event = {EPOLLIN, {.ptr = NULL}};
+
+  this->rotation = rotation;
+
+  this->fd = epoll_create1 (EPOLL_CLOEXEC);
+  if (this->fd < 0)
+    return NULL;
+
+  this->inotify_fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+  if (this->inotify_fd >= 0)
+  {
+    inotify_add_watch (this->inotify_fd, "/dev/input",
+                       IN_CREATE | IN_ATTRIB | IN_DELETE);
+    epoll_ctl (this->fd, EPOLL_CTL_ADD, this->inotify_fd, &event);
+  }
+
+  scan_devices ();
+  if (this->device_count == 0)
+  {
+    fprintf (stderr, "no readable evdev keyboards or pointers\n");
+    destroy ();
+    return NULL;
+  }
+
+  /* keep the keys from being echoed, or ^C from reaching us */
+  if (isatty (STDIN_FILENO) &&
+      tcgetattr (STDIN_FILENO, &this->orig_attr) == 0)
+  {
+    struct termios raw = this->orig_attr;
+    cfmakeraw (&raw);
+    this->have_termios = tcsetattr (STDIN_FILENO, TCSAFLUSH, &raw) == 0;
+    atexit (restore_terminal);
+  }
+
+  _mrg_evsrc_coord = this;
+  return &ev_src_evdev;
+}
@@ -23,17 +23,55 @@ OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
 /* written to work with the zforce ir touchscreen of a kobo glo,
  * probably works with a range of /dev/input/event classs of
  * touchscreens.
+ *
+ * Input is read in batches of events and accumulated until the SYN_REPORT
+ * that ends a frame, fingers are tracked in the slots of multi-touch
+ * protocol B, with single touch devices treated as having one slot. Each
+ * frame yields at most one event per finger that changed:
+ *
+ *   mouse-press|mouse-drag|mouse-release x y finger usecs
+ *   touch-press|touch-drag|touch-release x y finger usecs
+ *
+ * the first finger down acts as the mouse pointer, the others are given as
+ * touch events; usecs is the kernel timestamp of the frame.
  */
 
+#define TS_SLOTS      10
+#define TS_READ_BATCH 64
+
+typedef struct TsSlot
+{
+  int    id;       /* tracking id, -1 when no finger is down */
+  double x;
+  double y;
+  int    was_down; /* as of the last emitted event */
+  int    changed;
+} TsSlot;
+
 typedef struct Ts
 {
   int    fd;
-  double  x;
+  double  x;       /* of the pointer finger, for _mmm_get_coords */
   double  y;
   int    down;
   int    rotate;
   int    width;
   int    height;
+
+  TsSlot slot[TS_SLOTS];
+  int    cur_slot;
+  int    mt;       /* the device reports multi-touch slots */
+  int    pointer;  /* slot acting as the mouse, or -1 */
+  int    dropped;  /* skipping to the next SYN_REPORT after an overrun */
+
+  struct input_event buf[TS_READ_BATCH];
+  int    buf_pos;
+  int    buf_len;
+
+  char  *queue[TS_SLOTS];
+  int    queue_pos;
+  int    queue_len;
+  int64_t queue_time; /* kernel time of the frame queued */
 } Ts;
 
 static Ts ts;
@@ -76,9 +114,13 @@ static int read_sys_int2 (const char *path, const char c)
 
 static int ufb_evsource_ts_init ()
 {
+  int i;
   /* need to detect which event */
 
   this->down = 0;
+  this->pointer = -1;
+  for (i = 0; i < TS_SLOTS; i++)
+    this->slot[i].id = -1;
   this->fd = open ("/dev/input/event1", O_RDONLY | O_NONBLOCK);
 
   this->rotate = read_sys_int ("/sys/class/graphics/fb0/rotate");
@@ -104,6 +146,8 @@ static void destroy ()
 {
   if (this->fd != -1)
     close (this->fd);
+  while (this->queue_pos < this->queue_len)
+    free (this->queue[this->queue_pos++]);
 }
 
 static int has_event ()
@@ -111,6 +155,10 @@ static int has_event ()
   struct timeval tv;
   int retval;
 
+  if (this->queue_pos < this->queue_len ||
+      this->buf_pos < this->buf_len)
+    return 1;
+
   if (this->fd == -1)
     return 0;
 
@@ -124,81 +172,152 @@ static int has_event ()
   return 0;
 }
 
-static char *get_event ()
+static void queue_slot (int no, const struct timeval *time)
 {
-  const char *ret = "mouse-motion";
-  struct input_event ev;
-  int buttstate = 0;
-  int sync = 0;
-
-  while (!sync){
-    int rc = read (this->fd, &ev, sizeof (ev));
-    if (rc != sizeof (ev))
-    {
-      //fprintf (stderr, "zforce read fail\n");
-      return NULL;
-    }
-    else
-    {
-      switch (ev.type)
+  TsSlot *slot = &this->slot[no];
+  int down = slot->id != -1;
+  const char *kind;
+  double x, y;
+  char *r;
+
+  if (!down && !slot->was_down)
+  {
+    slot->changed = 0;
+    return;
+  }
+  if (down && !slot->was_down && this->pointer == -1)
+    this->pointer = no;
+
+  if (no == this->pointer)
+    kind = !down ? "mouse-release" : slot->was_down ? "mouse-drag" :
+                                                      "mouse-press";
+  else
+    kind = !down ? "touch-release" : slot->was_down ? "touch-drag" :
+                                                      "touch-press";
+
+  switch (this->rotate)
+  {
+    case 1:  x = slot->y;                y = this->height - slot->x; break;
+    case 2:  x = this->height - slot->x; y = this->width - slot->y;  break;
+    case 3:  x = this->height - slot->y; y = slot->x;                break;
+    case 0:
+    default: x = slot->x;                y = slot->y;                break;
+  }
+
+  r = malloc (96);
+  sprintf (r, "%s %.0f %.0f %i %lli", kind, x, y, no,
+           (long long)time->tv_sec * 1000000 + time->tv_usec);
+  this->queue[this->queue_len++] = r;
+
+  if (no == this->pointer)
+  {
+    this->x = slot->x;
+    this->y = slot->y;
+    this->down = down;
+    if (!down)
+      this->pointer = -1;
+  }
+  slot->was_down = down;
+  slot->changed = 0;
+}
+
+/* turns the state accumulated for a frame into events, the pointer first */
+static void frame_done (const struct timeval *time)
+{
+  int i;
+
+  this->queue_pos = this->queue_len = 0;
+  this->queue_time = time->tv_sec * (int64_t)1000000 + time->tv_usec;
+  if (this->pointer != -1 && this->slot[this->pointer].changed)
+    queue_slot (this->pointer, time);
+  for (i = 0; i < TS_SLOTS; i++)
+    if (this->slot[i].changed)
+      queue_slot (i, time);
+}
+
+static void handle_event (const struct input_event *ev)
+{
+  TsSlot *slot = &this->slot[this->cur_slot];
+
+  if (this->dropped)
+  {
+    if (ev->type == EV_SYN && ev->code == SYN_REPORT)
+      this->dropped = 0;
+    return;
+  }
+
+  switch (ev->type)
+  {
+    case EV_ABS:
+      switch (ev->code)
       {
-        case 3:
-          switch (ev.code)
-            {
-              case 0: this->x = ev.value; break;
-              case 1: this->y = ev.value; break;
-              default: break;
-            }
+        case ABS_MT_SLOT:
+          this->mt = 1;
+          if (ev->value >= 0 && ev->value < TS_SLOTS)
+            this->cur_slot = ev->value;
+          break;
+        case ABS_MT_TRACKING_ID:
+          this->mt = 1;
+          slot->id = ev->value;
+          slot->changed = 1;
           break;
-        case 1:
-          switch (ev.code)
-          {
-            case 0x014a:
-              switch (ev.value)
-                {
-                  case 0: ret = "mouse-release";
-                          this->down = 0;
-                     break;
-                  case 1: ret = "mouse-press";
-                          this->down = 1;
-                     break;
-                }
-              buttstate = 1;
-              break;
-          }
+        case ABS_MT_POSITION_X:
+        case ABS_X:
+          /* multi-touch devices also report the first finger on the
+           * single touch axes, those are only used without slots
+           */
+          if (ev->code == ABS_X && this->mt) break;
+          slot->x = ev->value;
+          slot->changed = 1;
           break;
-        case 0: /* sync (end of packet) */
-          sync = 1;
+        case ABS_MT_POSITION_Y:
+        case ABS_Y:
+          if (ev->code == ABS_Y && this->mt) break;
+          slot->y = ev->value;
+          slot->changed = 1;
           break;
       }
-    }
+      break;
+    case EV_KEY:
+      /* single touch devices, on multi-touch ones the tracking ids tell
+       * which fingers are down
+       */
+      if (ev->code == BTN_TOUCH && !this->mt)
+      {
+        if (ev->value && slot->id == -1)
+          slot->id = 0;
+        else if (!ev->value)
+          slot->id = -1;
+        slot->changed = 1;
+      }
+      break;
+    case EV_SYN:
+      if (ev->code == SYN_REPORT)
+        frame_done (&ev->time);
+      else if (ev->code == SYN_DROPPED)
+        this->dropped = 1;
+      break;
   }
+}
 
-  if (!buttstate && this->down)
-    ret = "mouse-drag";
-
+static char *get_event (EvSource *ev_source)
+{
+  while (this->queue_pos >= this->queue_len)
   {
-    char *r = malloc (64);
-    switch (this->rotate)
+    if (this->buf_pos >= this->buf_len)
     {
-      case 1:
-        sprintf (r, "%s %.0f %.0f", ret, this->y, this->height-this->x);
-        break;
-      case 2:
-        sprintf (r, "%s %.0f %.0f", ret, this->height-this->x, this->width-this->y);
-        break;
-      case 3:
-        sprintf (r, "%s %.0f %.0f", ret, this->height-this->y, this->x);
-        break;
-      case 0:
-      default:
-        sprintf (r, "%s %.0f %.0f", ret, this->x, this->y);
-        break;
+      int rc = read (this->fd, this->buf, sizeof (this->buf));
+      if (rc < (int)sizeof (struct input_event))
+        return NULL;
+      this->buf_len = rc / sizeof (struct input_event);
+      this->buf_pos = 0;
     }
-    return r;
+    while (this->buf_pos < this->buf_len &&
+           this->queue_pos >= this->queue_len)
+      handle_event (&this->buf[this->buf_pos++]);
   }
-
-  return NULL;
+  ev_source->time = this->queue_time;
+  return this->queue[this->queue_pos++];
 }
 
 static int get_fd (EvSource *ev_source)
@@ -2,6 +2,7 @@
 #define EVSOURCE_H
 
 #include <unistd.h>
+#include <stdint.h>
 
 typedef struct _EvSource EvSource;
 
@@ -28,6 +29,11 @@ struct _EvSource
    */
 
   /* if this returns non-0 select can be used for non-blocking.. */
+
+  /* when the input behind the last event returned by get_event happened,
+   * in mmm_timestamp () microseconds - 0 if the source does not know.
+   */
+  int64_t time;
 };
 
 #define evsource_has_event(es)   (es)->has_event((es))
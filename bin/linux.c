@@ -34,13 +34,27 @@ OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
 #include <sys/time.h>
 #include <sys/stat.h>
 
+#ifndef FBIO_WAITFORVSYNC
+#define FBIO_WAITFORVSYNC _IOW('F', 0x20, uint32_t)
+#endif
+
 #include "host.h"
+#include "host-composite.h"
+#include "host-trace.h"
+#include "host-stats.h"
+#include "host-cursor.h"
+#include "host-bands.h"
+#include "host-scale.h"
+#include "host-rotate.h"
+#include "host-blend.h"
+#include "host-convert.h"
 
 #include "linux-evsource.h"
 
 EvSource *evsource_ts_new (void);
 EvSource *evsource_kb_new (void);
 EvSource *evsource_mice_new (void);
+EvSource *evsource_evdev_new (int rotation);
 
 typedef struct _HostLinux   HostLinux;
 
@@ -53,7 +67,21 @@ struct _HostLinux
   int          fb_fd;
   int          fb_bits;
   int          fb_bpp;
-  uint8_t     *front_buffer;
+  uint8_t     *front_buffer; /* the mmapped device memory */
+  uint8_t     *buffer;       /* what we compose into; the shadow buffer, or
+                                front_buffer when drawing directly */
+  uint8_t     *shadow;
+  int          buffer_stride;
+  int          rotation;     /* of the display, clockwise; MMM_ROTATE */
+  uint8_t     *strip;        /* rows being rotated, with the cursor */
+  int          fb_pages;     /* 2 when page flipping with FBIOPAN_DISPLAY */
+  int          fb_page;      /* the page currently scanned out */
+  int          fb_vsync;
+  int          damage_x0, damage_y0, damage_x1, damage_y1;
+  int          prev_x0, prev_y0, prev_x1, prev_y1;
+  uint8_t     *scanline;     /* a row being uploaded, with the cursor */
+  HostCursor   cursor;
+  HostConvert  convert;
   int          fb_stride;
   int          fb_width;
   int          fb_height;
@@ -68,11 +96,11 @@ struct _HostLinux
   int          vt;
   int          vt_active;
   int          tty;
-};
 
-EvSource *evsource_ts_new (void);
-EvSource *evsource_kb_new (void);
-EvSource *evsource_mice_new (void);
+  Client      *scanout;          /* drawing straight to the device */
+  Client      *scanout_refused;  /* too old a client, or unable, to do so */
+  int          pointer_seen;     /* the cursor is shown after pointer input */
+};
 
 static int host_add_evsource (Host *host, EvSource *source)
 {
@@ -80,6 +108,7 @@ static int host_add_evsource (Host *host, EvSource *source)
   if (source)
   {
     host_linux->evsource[host_linux->evsource_count++] = source;
+    host_watch_fd (host, evsource_get_fd (source));
   }
   return 0;
 }
@@ -178,14 +207,23 @@ static int event_check_pending (Host *host)
     while (evsource_has_event (host_linux->evsource[i]))
     {
       char *event = evsource_get_event (host_linux->evsource[i]);
+      if (event && host_stats_hud_event (host, event))
+      {
+        free (event);
+        continue;
+      }
       if (event)
       {
+        if (!strncmp (event, "mouse-", 6))
+          host_linux->pointer_seen = 1;
+        host_event_focus (host, event);
         if (host->focused)
         {
-          mmm_add_event (host->focused->mmm, event);
-          free (event);
+          host_client_add_event_at (host, host->focused, event,
+                                    host_linux->evsource[i]->time);
           had_event ++;
         }
+        free (event);
       }
     }
   }
@@ -193,300 +231,704 @@ static int event_check_pending (Host *host)
   return had_event != 0;
 }
 
-static inline void memcpy32_16 (uint8_t *dst, const uint8_t *src, int count)
+void _mmm_get_coords (Mmm *mmm, double *x, double *y);
+
+
+/* converts a row of client pixels to the fb pixel format, used when
+ * updating the client caches
+ */
+static void convert_row (Host *host, uint8_t *dst, const uint8_t *src,
+                         int x, int y, int count)
 {
-  while (count--)
-    {
-      int big = ((src[0] >> 3)) +
-                ((src[1] >> 2)<<5) +
-                ((src[2] >> 3)<<11);
-      dst[1] = big >> 8;
-      dst[0] = big & 255;
-      dst+=2;
-      src+=4;
-    }
+  HostLinux *host_linux = (void*)host;
+  host_convert_row (&host_linux->convert, dst, src, x, y, count);
 }
 
-static inline void memcpy32_15 (uint8_t *dst, const uint8_t *src, int count)
+typedef struct _BlitRows BlitRows;
+
+struct _BlitRows
 {
-  while (count--)
-    {
-      int big = ((src[2] >> 3)) +
-                ((src[1] >> 3)<<5) +
-                ((src[0] >> 3)<<10);
-      dst[1] = big >> 8;
-      dst[0] = big & 255;
-      dst+=2;
-      src+=4;
-    }
-}
+  uint8_t       *dst;
+  const uint8_t *src;
+  int            dst_stride;
+  int            src_stride;
+  int            copy_bytes;
+  int            blend;
+};
 
-static inline void memcpy32_8 (uint8_t *dst, const uint8_t *src, int count)
+static void blit_rows (void *data, int y0, int y1)
 {
-  while (count--)
-    {
-      dst[0] = ((src[0] >> 5)) +
-               ((src[1] >> 5)<<3) +
-               ((src[2] >> 6)<<6);
-      dst+=1;
-      src+=4;
-    }
+  BlitRows *rows = data;
+  uint8_t *dst = rows->dst + y0 * rows->dst_stride;
+  const uint8_t *src = rows->src + y0 * rows->src_stride;
+  int scan;
+
+  for (scan = y0; scan < y1; scan ++)
+  {
+    if (rows->blend)
+      host_blend_over (dst, src, rows->copy_bytes / 4);
+    else
+      memcpy (dst, src, rows->copy_bytes);
+    dst += rows->dst_stride;
+    src += rows->src_stride;
+  }
 }
 
-static inline void memcpy32_24 (uint8_t *dst, const uint8_t *src, int count)
+/* copy the part of a client cache, already in the fb pixel format, that is
+ * within the screen rectangle x0,y0 - x1,y1 to the composition buffer.
+ */
+static void blit_rect (Host *host, Client *client,
+                       const uint8_t *pixels, int rowstride,
+                       int x, int y, int x0, int y0, int x1, int y1)
 {
-  while (count--)
-    {
-      dst[0] = src[0];
-      dst[1] = src[1];
-      dst[2] = src[2];
-      dst+=3;
-      src+=4;
-    }
+  HostLinux *host_linux = (void*)host;
+  int bpp = host_linux->fb_bpp;
+  BlitRows rows;
+
+  rows.dst = host_linux->buffer + y0 * host_linux->buffer_stride + x0 * bpp;
+  rows.src = pixels + (y0 - y) * rowstride + (x0 - x) * bpp;
+  rows.dst_stride = host_linux->buffer_stride;
+  rows.src_stride = rowstride;
+  rows.copy_bytes = (x1 - x0) * bpp;
+  /* the cache is only RGBA with 32bit framebuffers, translucent clients
+   * are drawn opaque on the others
+   */
+  rows.blend = client->translucent && bpp == 4;
+  host_bands_run (blit_rows, &rows, 0, y1 - y0, rows.copy_bytes);
 }
 
-void _mmm_get_coords (Mmm *mmm, double *x, double *y);
-
-#if 0
-static uint8_t cursor[16][16]={
-{1,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
-{1,2,1,1,0,0,0,0,0,0,0,0,0,0,0,0},
-{0,1,2,2,1,1,0,0,0,0,0,0,0,0,0,0},
-{0,1,2,2,2,2,1,1,0,0,0,0,0,0,0,0},
-{0,0,1,2,2,2,2,2,1,1,0,0,0,0,0,0},
-{0,0,1,2,2,2,2,2,2,2,1,1,0,0,0,0},
-{0,0,0,1,2,2,2,2,2,2,2,2,1,1,0,0},
-{0,0,0,1,2,2,2,2,1,1,1,1,1,1,1,1},
-{0,0,0,0,1,2,2,1,0,0,0,0,0,0,0,0},
-{0,0,0,0,1,2,2,1,0,0,0,0,0,0,0,0},
-{0,0,0,0,0,1,2,1,0,0,0,0,0,0,0,0},
-{0,0,0,0,0,1,2,1,0,0,0,0,0,0,0,0},
-{0,0,0,0,0,0,1,1,0,0,0,0,0,0,0,0},
-{0,0,0,0,0,0,1,1,0,0,0,0,0,0,0,0},
-{0,0,0,0,0,0,0,1,0,0,0,0,0,0,0,0},
-{0,0,0,0,0,0,0,1,0,0,0,0,0,0,0,0}};
-
-#else
-
-static uint8_t cursor[16][16]={
-{1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
-{1,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
-{1,2,1,0,0,0,0,0,0,0,0,0,0,0,0,0},
-{1,2,2,1,0,0,0,0,0,0,0,0,0,0,0,0},
-{1,2,2,2,1,0,0,0,0,0,0,0,0,0,0,0},
-{1,2,2,2,2,1,0,0,0,0,0,0,0,0,0,0},
-{1,2,2,2,2,2,1,0,0,0,0,0,0,0,0,0},
-{1,2,2,2,2,2,2,1,0,0,0,0,0,0,0,0},
-{1,2,2,2,2,2,2,2,1,0,0,0,0,0,0,0},
-{1,2,2,2,2,2,2,2,1,1,0,0,0,0,0,0},
-{1,2,2,2,2,2,1,1,0,0,0,0,0,0,0,0},
-{1,2,2,2,2,2,1,0,0,0,0,0,0,0,0,0},
-{1,2,1,1,2,2,1,0,0,0,0,0,0,0,0,0},
-{1,1,0,1,2,2,2,1,0,0,0,0,0,0,0,0},
-{0,0,0,0,1,2,2,1,0,0,0,0,0,0,0,0},
-{0,0,0,0,1,1,1,0,0,0,0,0,0,0,0,0}};
-
-#endif
-
-static void render_client (Host *host, Client *client, float ptr_x, float ptr_y)
+/* draw the part of a scaled client within x0,y0 - x1,y1 */
+static void scale_rect (Host *host, Client *client,
+                        const uint8_t *pixels, int rowstride,
+                        int width, int height, int x0, int y0, int x1, int y1)
 {
   HostLinux *host_linux = (void*)host;
-  //SDL_Surface *screen = host_linux->screen;
+  HostScale scale;
+
+  scale.src = pixels;
+  scale.src_stride = rowstride;
+  scale.src_width = width;
+  scale.src_height = height;
+  scale.bpp = host_linux->fb_bpp;
+  scale.x = client->x;
+  scale.y = client->y;
+  scale.scale = client->scale;
+  scale.filter = client->scale_filter;
+  scale.blend = client->translucent && host_linux->fb_bpp == 4;
+  host_scale_rect (&scale, host_linux->buffer, host_linux->buffer_stride,
+                   x0, y0, x1, y1);
+}
+
+static void render_client (Host *host, Client *client)
+{
   int width, height, rowstride;
   const unsigned char *pixels;
+  int x, y;
+  int i;
 
   if (client->pid == getpid ())
     return;
 
-  int cwidth, cheight;
-  int x = mmm_get_x (client->mmm);
-  int y = mmm_get_y (client->mmm);
+  x = client->x;
+  y = client->y;
+
+  if (client->occluded)
+  {
+    /* nothing of it is visible, acknowledge the frame without reading it,
+     * the buffer is read once some of it becomes visible again
+     */
+    host_client_skip (host, client);
+    return;
+  }
 
   if (y > host->dirty_ymax ||
       x > host->dirty_xmax)
     return;
 
-  pixels = mmm_get_buffer_read (client->mmm, &width, &height, &rowstride);
+  pixels = host_client_read (host, client, &width, &height, &rowstride);
 
-  if (ptr_x >= x && ptr_x < x + width &&
-      ptr_y >= y && ptr_y < y + height)
+  if (pixels && width && height)
+  {
+    for (i = 0; i < client->visible_count; i++)
     {
-      host->focused = client;
+      MmmRectangle *rect = &client->visible[i];
+      int x0 = rect->x;
+      int y0 = rect->y;
+      int x1 = rect->x + rect->width;
+      int y1 = rect->y + rect->height;
+
+      if (x0 < host->dirty_xmin) x0 = host->dirty_xmin;
+      if (y0 < host->dirty_ymin) y0 = host->dirty_ymin;
+      if (x1 > host->dirty_xmax) x1 = host->dirty_xmax;
+      if (y1 > host->dirty_ymax) y1 = host->dirty_ymax;
+      if (client->scale != 1.0f)
+      {
+        if (x1 > x + client->width)  x1 = x + client->width;
+        if (y1 > y + client->height) y1 = y + client->height;
+        if (x1 > x0 && y1 > y0)
+          scale_rect (host, client, pixels, rowstride, width, height,
+                      x0, y0, x1, y1);
+        continue;
+      }
+      if (x1 > x + width)  x1 = x + width;
+      if (y1 > y + height) y1 = y + height;
+
+      if (x1 > x0 && y1 > y0)
+        blit_rect (host, client, pixels, rowstride, x, y, x0, y0, x1, y1);
     }
+  }
+}
 
-  if (pixels && width && height)
+/* fill the dirty region with the background */
+static void clear_dirt (Host *host)
+{
+  HostLinux *host_linux = (void*)host;
+  int bpp = host_linux->fb_bpp;
+  int x0 = host->dirty_xmin < 0 ? 0 : host->dirty_xmin;
+  int y0 = host->dirty_ymin < 0 ? 0 : host->dirty_ymin;
+  int x1 = host->dirty_xmax > host->width ? host->width : host->dirty_xmax;
+  int y1 = host->dirty_ymax > host->height ? host->height : host->dirty_ymax;
+  int scan;
+
+  for (scan = y0; scan < y1; scan++)
+    memset (host_linux->buffer + scan * host_linux->buffer_stride + x0 * bpp,
+            255, (x1 - x0) * bpp);
+}
+
+/* grow the region that fb_present has to upload from the shadow buffer */
+static void fb_add_damage (Host *host, int x0, int y0, int x1, int y1)
+{
+  HostLinux *host_linux = (void*)host;
+
+  if (x0 < 0) x0 = 0;
+  if (y0 < 0) y0 = 0;
+  if (x1 > host->width)  x1 = host->width;
+  if (y1 > host->height) y1 = host->height;
+  if (x1 <= x0 || y1 <= y0)
+    return;
+
+  if (host_linux->damage_x1 <= host_linux->damage_x0)
   {
-    int front_offset = y * host->stride + x * host->bpp;
-    uint8_t *dst = host_linux->front_buffer + front_offset;
-    const uint8_t *src = pixels;
-    int copy_count;
+    host_linux->damage_x0 = x0;
+    host_linux->damage_y0 = y0;
+    host_linux->damage_x1 = x1;
+    host_linux->damage_y1 = y1;
+    return;
+  }
+  if (x0 < host_linux->damage_x0) host_linux->damage_x0 = x0;
+  if (y0 < host_linux->damage_y0) host_linux->damage_y0 = y0;
+  if (x1 > host_linux->damage_x1) host_linux->damage_x1 = x1;
+  if (y1 > host_linux->damage_y1) host_linux->damage_y1 = y1;
+}
+
+/* copy logical rows to a rotated display, in strips a tile high */
+static void fb_upload_rotated (Host *host, uint8_t *fb,
+                               int x0, int y0, int x1, int y1)
+{
+  HostLinux *host_linux = (void*)host;
+  int bpp = host_linux->fb_bpp;
+  int copy_bytes = (x1 - x0) * bpp;
+  int y;
 
-    int start_scan;
-    int end_scan;
+  for (y = y0; y < y1; y += HOST_ROTATE_TILE)
+  {
+    int rows = y1 - y < HOST_ROTATE_TILE ? y1 - y : HOST_ROTATE_TILE;
+    const uint8_t *src = host_linux->shadow + y * host_linux->buffer_stride +
+                         x0 * bpp;
+    int src_stride = host_linux->buffer_stride;
     int scan;
 
-    start_scan = y;
-    end_scan = y + height;
+    for (scan = y; scan < y + rows; scan++)
+      if (host_cursor_hits (&host_linux->cursor, scan, x0, x1))
+        break;
 
-    if (end_scan < host->dirty_ymin ||
-        x + width < host->dirty_xmin)
+    if (scan < y + rows)
     {
-      mmm_read_done (client->mmm);
-      return;
+      for (scan = y; scan < y + rows; scan++)
+      {
+        uint8_t *row = host_linux->strip + (scan - y) * copy_bytes;
+        memcpy (row, src + (scan - y) * src_stride, copy_bytes);
+        host_cursor_overlay (&host_linux->cursor, row, scan, x0, x1);
+      }
+      src = host_linux->strip;
+      src_stride = copy_bytes;
     }
 
-    if (start_scan < host->dirty_ymin)
-      start_scan = host->dirty_ymin;
-    if (end_scan > host->dirty_ymax)
-      end_scan = host->dirty_ymax;
-    start_scan -= y;
-    end_scan -= y;
-    
-    copy_count = host->width - x;
-    if (copy_count > width)
+    host_rotate_rect (fb, host_linux->fb_stride,
+                      host_linux->vinfo.xres, host_linux->vinfo.yres,
+                      src, src_stride, bpp, host_linux->rotation,
+                      x0, y, x1 - x0, rows);
+  }
+}
+
+static void fb_upload (Host *host, int page, int x0, int y0, int x1, int y1)
+{
+  HostLinux *host_linux = (void*)host;
+  int stride = host_linux->fb_stride;
+  int bpp = host_linux->fb_bpp;
+  uint8_t *fb = host_linux->front_buffer +
+                page * host_linux->vinfo.yres * stride;
+  uint8_t *dst = fb + y0 * stride + x0 * bpp;
+  const uint8_t *src = host_linux->shadow + y0 * host_linux->buffer_stride +
+                       x0 * bpp;
+  int copy_bytes = (x1 - x0) * bpp;
+  int scan;
+
+  host_stats_bytes ((long)copy_bytes * (y1 - y0));
+  if (host_linux->rotation)
+  {
+    fb_upload_rotated (host, fb, x0, y0, x1, y1);
+    return;
+  }
+
+  for (scan = y0; scan < y1; scan ++)
+  {
+    /* the cursor is never drawn into the shadow, only laid over the rows
+     * on their way to the device
+     */
+    if (host_cursor_hits (&host_linux->cursor, scan, x0, x1))
     {
-      copy_count = width;
+      memcpy (host_linux->scanline, src, copy_bytes);
+      host_cursor_overlay (&host_linux->cursor, host_linux->scanline,
+                           scan, x0, x1);
+      memcpy (dst, host_linux->scanline, copy_bytes);
     }
+    else
+      memcpy (dst, src, copy_bytes);
+    dst += stride;
+    src += host_linux->buffer_stride;
+  }
+}
 
-    if (host->dirty_xmin > x)
+/* make what has been composed in the shadow buffer visible; with a single
+ * page only the damage is written to the device, when flipping the hidden
+ * page also needs what changed on the other page in the previous frame.
+ */
+static void fb_present (Host *host)
+{
+  HostLinux *host_linux = (void*)host;
+  int x0 = host_linux->damage_x0;
+  int y0 = host_linux->damage_y0;
+  int x1 = host_linux->damage_x1;
+  int y1 = host_linux->damage_y1;
+  uint32_t crtc = 0;
+
+  /* another vt owns the display, we get a full redraw when it is ours again */
+  if (!host_linux->vt_active)
+    return;
+
+  host_linux->damage_x1 = host_linux->damage_x0 = 0;
+  if (host_linux->buffer == host_linux->front_buffer || x1 <= x0)
+    return;
+
+  if (host_linux->fb_pages == 2)
+  {
+    int back = !host_linux->fb_page;
+    int ux0 = x0, uy0 = y0, ux1 = x1, uy1 = y1;
+
+    if (host_linux->prev_x1 > host_linux->prev_x0)
     {
-      dst += host_linux->fb_bpp * (host->dirty_xmin - x);
-      src += host->bpp * (host->dirty_xmin - x);
-      copy_count -= (host->dirty_xmin - x);
+      if (host_linux->prev_x0 < ux0) ux0 = host_linux->prev_x0;
+      if (host_linux->prev_y0 < uy0) uy0 = host_linux->prev_y0;
+      if (host_linux->prev_x1 > ux1) ux1 = host_linux->prev_x1;
+      if (host_linux->prev_y1 > uy1) uy1 = host_linux->prev_y1;
     }
+    host_linux->prev_x0 = x0;
+    host_linux->prev_y0 = y0;
+    host_linux->prev_x1 = x1;
+    host_linux->prev_y1 = y1;
+
+    fb_upload (host, back, ux0, uy0, ux1, uy1);
 
-    if (host->dirty_xmin + copy_count > host->dirty_xmax)
+    host_linux->vinfo.yoffset = back * host_linux->vinfo.yres;
+    if (ioctl (host_linux->fb_fd, FBIOPAN_DISPLAY, &host_linux->vinfo) == -1)
     {
-      copy_count = (host->dirty_xmax - host->dirty_xmin);
+      fprintf (stderr, "FBIOPAN_DISPLAY failed, no longer page flipping\n");
+      host_linux->fb_pages = 1;
+      host_linux->vinfo.yoffset = 0;
+      ioctl (host_linux->fb_fd, FBIOPAN_DISPLAY, &host_linux->vinfo);
+      host_linux->fb_page = 0;
+      fb_upload (host, 0, 0, 0, host->width, host->height);
+      return;
     }
+    host_linux->fb_page = back;
 
-    dst += (host_linux->fb_stride) * start_scan;
-    src += (rowstride) * start_scan;
+    /* the page that was just scanned out is drawn to next, do not return
+     * before the flip has taken place
+     */
+    if (host_linux->fb_vsync)
+      ioctl (host_linux->fb_fd, FBIO_WAITFORVSYNC, &crtc);
+  }
+  else
+  {
+    if (host_linux->fb_vsync)
+      ioctl (host_linux->fb_fd, FBIO_WAITFORVSYNC, &crtc);
+    fb_upload (host, host_linux->fb_page, x0, y0, x1, y1);
+  }
+}
 
-    switch (host_linux->fb_bits)
-     {
-       case 32:
-          for (scan = start_scan; scan < end_scan; scan ++)
-          {
-            if (dst >= (uint8_t*)host_linux->front_buffer &&
-                dst < ((uint8_t*)host_linux->front_buffer) + (host_linux->fb_stride * host->height) - copy_count * 4)
-            memcpy (dst, src, copy_count * 4);
-            dst += host_linux->fb_stride;
-            src += rowstride;
-          }
-          break;
-       case 24:
-          for (scan = start_scan; scan < end_scan; scan ++)
-          {
-            if (dst >= (uint8_t*)host_linux->front_buffer &&
-                dst < ((uint8_t*)host_linux->front_buffer) + (host_linux->fb_stride * host->height) - copy_count)
-            memcpy32_24 (dst, src, copy_count);
-            dst += host_linux->fb_stride;
-            src += rowstride;
-          }
-          break;
-       case 16:
-          for (scan = start_scan; scan < end_scan; scan ++)
-          {
-            if (dst >= (uint8_t*)host_linux->front_buffer &&
-                dst < ((uint8_t*)host_linux->front_buffer) + (host_linux->fb_stride * host->height) - copy_count)
-            memcpy32_16 (dst, src, copy_count);
-            dst += host_linux->fb_stride;
-            src += rowstride;
-          }
-          break;
-       case 15:
-          for (scan = start_scan; scan < end_scan; scan ++)
-          {
-            if (dst >= (uint8_t*)host_linux->front_buffer &&
-                dst < ((uint8_t*)host_linux->front_buffer) + (host_linux->fb_stride * host->height) - copy_count)
-            memcpy32_15 (dst, src, copy_count);
-            dst += host_linux->fb_stride;
-            src += rowstride;
-          }
-          break;
-       case 8:
-          for (scan = start_scan; scan < end_scan; scan ++)
-          {
-            if (dst >= (uint8_t*)host_linux->front_buffer &&
-                dst < ((uint8_t*)host_linux->front_buffer) + (host_linux->fb_stride * host->height) - copy_count)
-            memcpy32_8 (dst, src, copy_count);
-            dst += host_linux->fb_stride;
-            src += rowstride;
-          }
-          break;
-      }
-    }
-    mmm_read_done (client->mmm);
-  mmm_host_get_size (client->mmm, &cwidth, &cheight);
+/* move the cursor, only the rectangles it leaves and enters are redrawn */
+static void move_cursor (Host *host, int x, int y)
+{
+  HostLinux *host_linux = (void*)host;
+  HostCursor *cursor = &host_linux->cursor;
+
+  if (cursor->shown && cursor->x == x && cursor->y == y)
+    return;
+
+  if (host_linux->buffer == host_linux->front_buffer)
+  {
+    host_cursor_undraw (cursor, host_linux->buffer, host_linux->buffer_stride);
+    host_cursor_draw (cursor, host_linux->buffer, host_linux->buffer_stride,
+                      host->width, host->height, x, y);
+    return;
+  }
+
+  if (cursor->shown)
+    fb_add_damage (host, cursor->x, cursor->y,
+                   cursor->x + HOST_CURSOR_SIZE, cursor->y + HOST_CURSOR_SIZE);
+  cursor->shown = 1;
+  cursor->x = x;
+  cursor->y = y;
+  fb_add_damage (host, x, y, x + HOST_CURSOR_SIZE, y + HOST_CURSOR_SIZE);
 }
 
-/* drawing of the cursor should be separated from the blitting
- * maybe even copying from the frontbuffer the contents it
- * is overdrawing; (and undrawing the cursor before each flip)
+static int rect_contains (const MmmRectangle *a, const MmmRectangle *b)
+{
+  return b->x >= a->x && b->y >= a->y &&
+         b->x + b->width <= a->x + a->width &&
+         b->y + b->height <= a->y + a->height;
+}
+
+static int rect_overlaps (const MmmRectangle *a, const MmmRectangle *b)
+{
+  return b->x < a->x + a->width && b->x + b->width > a->x &&
+         b->y < a->y + a->height && b->y + b->height > a->y;
+}
+
+/* move pixels a client moved in what we have composed, rather than
+ * redrawing them - when all of them are the client's as last drawn
  */
+static int linux_copy_rect (Host *host, Client *client,
+                            const MmmRectangle *rect, int dx, int dy)
+{
+  HostLinux *host_linux = (void*)host;
+  HostCursor *cursor = &host_linux->cursor;
+  MmmRectangle screen = {0, 0, host->width, host->height};
+  MmmRectangle dst = {rect->x + dx, rect->y + dy, rect->width, rect->height};
+  int direct = host_linux->buffer == host_linux->front_buffer;
+  int cursor_shown = cursor->shown;
+  int i;
 
-static uint8_t cursor_backup[16*16*4];
-static int     cursor_backup_x = 0;
-static int     cursor_backup_y = 0;
+  if (!host_linux->vt_active || host_linux->scanout ||
+      host->stacking_changed || host_stats_hud_shown () ||
+      client->scale != 1.0f || client->translucent ||
+      !rect_contains (&screen, rect) || !rect_contains (&screen, &dst))
+    return 0;
 
-void draw_cursor (Host *host, int ptr_x, int ptr_y)
-{ 
-  int u,v;
-  cursor_backup_x = ptr_x;
-  cursor_backup_y = ptr_y;
+  /* parts not yet redrawn are not what the client moved */
+  if (host_is_dirty (host) &&
+      rect->x < host->dirty_xmax && rect->x + rect->width > host->dirty_xmin &&
+      rect->y < host->dirty_ymax && rect->y + rect->height > host->dirty_ymin)
+    return 0;
 
-  for (v = 0; v < 16; v ++)
-    if (v + ptr_y > 0 && v + ptr_y < host->height)
-      for (u = 0; u < 16; u ++)
-      {
-        if (u + ptr_x > 0 && u + ptr_x < host->width)
-        {
-          int o = host_linux->fb_stride * ((int)ptr_y+v) + host_linux->fb_bpp * ((int)(ptr_x)+u);
-          int i;
-          for (i = 0; i < host_linux->fb_bpp; i++)
-            cursor_backup[(v * 16 + u)*4 + i] = host_linux->front_buffer[o + i];
-
-          if (cursor[v][u] == 1)
-          {
-            for (i = 0; i < host_linux->fb_bpp; i++)
-              host_linux->front_buffer[o+i] = 255;
-          }
-          else if (cursor[v][u] == 2)
-          {
-            for (i = 0; i < host_linux->fb_bpp; i++)
-              host_linux->front_buffer[o+i] = 0;
-            if (host_linux->fb_bpp == 4)
-              host_linux->front_buffer[o+3] = 255;
-          }
-        }
-      }
+  for (i = 0; i < client->visible_count; i++)
+    if (rect_contains (&client->visible[i], rect) &&
+        rect_contains (&client->visible[i], &dst))
+      break;
+  if (i == client->visible_count)
+    return 0;
+
+  /* translucent clients do not occlude, but are blended into what we have
+   * composed - they would be moved along
+   */
+  for (i = 0; i < host->client_count && host->clients[i] != client; i++);
+  for (i++; i < host->client_count; i++)
+  {
+    Client *above = host->clients[i];
+    MmmRectangle area = {above->x, above->y, above->width, above->height};
+
+    if (above->translucent && !above->occluded &&
+        (rect_overlaps (&area, rect) || rect_overlaps (&area, &dst)))
+      return 0;
+  }
+
+  if (direct)
+    host_cursor_undraw (cursor, host_linux->buffer, host_linux->buffer_stride);
+  host_move_rect (host_linux->buffer, host_linux->buffer_stride,
+                  host_linux->fb_bpp, rect, dx, dy);
+  host_stats_bytes ((long)rect->width * rect->height * host_linux->fb_bpp);
+  if (direct && cursor_shown)
+    host_cursor_draw (cursor, host_linux->buffer, host_linux->buffer_stride,
+                      host->width, host->height, cursor->x, cursor->y);
+  else
+    fb_add_damage (host, dst.x, dst.y, dst.x + dst.width, dst.y + dst.height);
+  return 1;
 }
 
-void undraw_cursor (Host *host)
+/* try to get room for two pages in the device memory, so that we can
+ * compose into one while the other is scanned out
+ */
+static void fb_setup_pages (HostLinux *host_linux)
 {
-  int u,v;
-  int ptr_x = cursor_backup_x;
-  int ptr_y = cursor_backup_y;
+  struct fb_var_screeninfo vinfo = host_linux->vinfo;
+  uint32_t crtc = 0;
 
-  for (v = 0; v < 16; v ++)
-    if (v + ptr_y > 0 && v + ptr_y < host->height)
-      for (u = 0; u < 16; u ++)
-      {
-        if (u + ptr_x > 0 && u + ptr_x < host->width)
-        {
-          int o = host_linux->fb_stride * ((int)ptr_y+v) + host_linux->fb_bpp * ((int)(ptr_x)+u);
-          int i;
-          for (i = 0; i < host_linux->fb_bpp; i++)
-              host_linux->front_buffer[o + i] = cursor_backup[(v * 16 + u)*4 + i];
-        }
-      }
+  host_linux->fb_pages = 1;
+  host_linux->fb_page = 0;
+  host_linux->fb_vsync =
+    ioctl (host_linux->fb_fd, FBIO_WAITFORVSYNC, &crtc) == 0;
+
+  if (getenv ("MMM_FB_NOFLIP") ||
+      host_linux->finfo.ypanstep == 0 ||
+      vinfo.yres % host_linux->finfo.ypanstep)
+    return;
+
+  if (vinfo.yres_virtual < vinfo.yres * 2)
+  {
+    vinfo.yres_virtual = vinfo.yres * 2;
+    vinfo.yoffset = 0;
+    if (ioctl (host_linux->fb_fd, FBIOPUT_VSCREENINFO, &vinfo) == -1)
+      return;
+    if (ioctl (host_linux->fb_fd, FBIOGET_VSCREENINFO, &host_linux->vinfo) ||
+        ioctl (host_linux->fb_fd, FBIOGET_FSCREENINFO, &host_linux->finfo))
+      return;
+  }
+
+  if (host_linux->vinfo.yres_virtual < host_linux->vinfo.yres * 2 ||
+      host_linux->finfo.smem_len <
+        host_linux->finfo.line_length * host_linux->vinfo.yres * 2)
+    return;
+
+  host_linux->vinfo.yoffset = 0;
+  if (ioctl (host_linux->fb_fd, FBIOPAN_DISPLAY, &host_linux->vinfo) == -1)
+    return;
+
+  host_linux->fb_pages = 2;
+}
+
+/* direct scanout: a single fullscreen client whose pixels are laid out as
+ * the framebuffer's draws straight to the device, when flipping to the page
+ * not shown, and there is nothing for us to copy. As soon as anything else
+ * is to be shown we compose again.
+ */
+static int scanout_possible (Host *host, Client *client)
+{
+  HostLinux *host_linux = (void*)host;
+
+  if (getenv ("MMM_SCANOUT") && !strcmp (getenv ("MMM_SCANOUT"), "0"))
+    return 0;
+
+  return host->single_app &&
+         host->client_count == 1 &&
+         host->clients[0] == client &&
+         client != host_linux->scanout_refused &&
+         client->pid != getpid () &&
+         host_linux->vt_active &&
+         !host_linux->rotation &&
+         !host_linux->pointer_seen &&
+         !host_stats_hud_shown () &&
+         host_linux->convert.bits == 32 &&
+         !host_linux->convert.grayscale &&
+         host_linux->fb_stride == host->width * 4 &&
+         client->x == 0 && client->y == 0 &&
+         client->width == host->width && client->height == host->height &&
+         mmm_get_width (client->mmm) == host->width &&
+         mmm_get_height (client->mmm) == host->height &&
+         client->scale == 1.0f &&
+         !client->translucent;
+}
+
+static int64_t scanout_offset (HostLinux *host_linux, int page)
+{
+  return (int64_t)page * host_linux->vinfo.yres * host_linux->fb_stride;
+}
+
+static void scanout_start (Host *host, Client *client)
+{
+  HostLinux *host_linux = (void*)host;
+  int page = host_linux->fb_pages == 2 ? !host_linux->fb_page :
+                                         host_linux->fb_page;
+  const uint8_t *pixels;
+  int width, height, stride;
+  int i, scan;
+
+  pixels = mmm_get_buffer_read_nowait (client->mmm, &width, &height, &stride);
+  if (!pixels)
+    return; /* drawing, try again later */
+
+  if (!mmm_host_set_scanout (client->mmm, host_linux->path,
+                             scanout_offset (host_linux, page),
+                             host_linux->fb_stride,
+                             host_linux->fb_mapped_size))
+  {
+    host_linux->scanout_refused = client;
+    mmm_read_done (client->mmm);
+    client->copy_applied = 0;
+    client->cache_stale = 1;
+    host_queue_draw (host, NULL);
+    return;
+  }
+
+  /* whatever the client draws next is on top of what it has drawn so far */
+  for (i = 0; i < host_linux->fb_pages; i++)
+  {
+    uint8_t *dst = host_linux->front_buffer + scanout_offset (host_linux, i);
+    for (scan = 0; scan < height; scan++)
+      memcpy (dst + scan * host_linux->fb_stride, pixels + scan * stride,
+              width * 4);
+  }
+  host_stats_bytes ((long)width * height * 4 * host_linux->fb_pages);
+  host_trace_frame (client);
+  mmm_read_done (client->mmm);
+  client->copy_applied = 0;
+  host_linux->scanout = client;
+}
+
+/* show a frame the client has drawn to the device */
+static void scanout_frame (Host *host)
+{
+  HostLinux *host_linux = (void*)host;
+  Client *client = host_linux->scanout;
+  int x, y, width, height;
+  MmmRectangle copy;
+  int dx, dy;
+  uint32_t crtc = 0;
+
+  if (!mmm_get_damage (client->mmm, &x, &y, &width, &height) ||
+      !mmm_get_buffer_read_nowait (client->mmm, NULL, NULL, NULL))
+    return;
+
+  host_trace_frame (client);
+  if (host_linux->fb_pages == 2)
+  {
+    int page = !host_linux->fb_page;
+    int64_t trace_start = mmm_trace_begin ();
+    long start = mmm_ticks ();
+    uint8_t *src, *dst;
+    int scan;
+
+    host_linux->vinfo.yoffset = page * host_linux->vinfo.yres;
+    ioctl (host_linux->fb_fd, FBIOPAN_DISPLAY, &host_linux->vinfo);
+    host_linux->fb_page = page;
+    if (host_linux->fb_vsync)
+      ioctl (host_linux->fb_fd, FBIO_WAITFORVSYNC, &crtc);
+    host_stats_add (HOST_STAT_PRESENT, mmm_ticks () - start);
+    mmm_trace_end (trace_start, "present", NULL);
+
+    /* the page that was shown is drawn to next, bring it up to date */
+    if (width <= 0 || height <= 0)
+    {
+      x = y = 0;
+      width = host->width;
+      height = host->height;
+    }
+    else if (mmm_get_copy (client->mmm, &copy, &dx, &dy))
+    {
+      int x1 = x + width, y1 = y + height;
+
+      if (copy.x + dx < x) x = copy.x + dx;
+      if (copy.y + dy < y) y = copy.y + dy;
+      if (copy.x + dx + copy.width > x1) x1 = copy.x + dx + copy.width;
+      if (copy.y + dy + copy.height > y1) y1 = copy.y + dy + copy.height;
+      width = x1 - x;
+      height = y1 - y;
+    }
+    src = host_linux->front_buffer + scanout_offset (host_linux, page) +
+          y * host_linux->fb_stride + x * 4;
+    dst = host_linux->front_buffer + scanout_offset (host_linux, !page) +
+          y * host_linux->fb_stride + x * 4;
+    for (scan = 0; scan < height; scan++)
+      memcpy (dst + scan * host_linux->fb_stride,
+              src + scan * host_linux->fb_stride, width * 4);
+    host_stats_bytes ((long)width * height * 4);
+
+    mmm_host_set_scanout (client->mmm, host_linux->path,
+                          scanout_offset (host_linux, !page),
+                          host_linux->fb_stride, host_linux->fb_mapped_size);
+  }
+  mmm_read_done (client->mmm);
+  client->copy_applied = 0;
+}
+
+/* hand the client its own buffer back, with what it drew on the device */
+static void scanout_stop (Host *host)
+{
+  HostLinux *host_linux = (void*)host;
+  Client *client = host_linux->scanout;
+  uint8_t *pixels;
+  int width, height, stride;
+  int scan;
+
+  pixels = (void*)mmm_get_buffer_read_nowait (client->mmm, &width, &height,
+                                              &stride);
+  if (!pixels)
+    return; /* drawing, try again later */
+
+  if (mmm_host_get_scanout (client->mmm) == 1)
+  {
+    const uint8_t *src = host_linux->front_buffer +
+      scanout_offset (host_linux, host_linux->fb_pages == 2 ?
+                                  !host_linux->fb_page : host_linux->fb_page);
+    if (height > (int)host_linux->vinfo.yres)
+      height = host_linux->vinfo.yres;
+    if (width * 4 > host_linux->fb_stride)
+      width = host_linux->fb_stride / 4;
+    for (scan = 0; scan < height; scan++)
+      memcpy (pixels + scan * stride, src + scan * host_linux->fb_stride,
+              width * 4);
+  }
+  /* it could not map the device, do not make it try again */
+  else if (mmm_host_get_scanout (client->mmm) == -1)
+    host_linux->scanout_refused = client;
+  mmm_host_set_scanout (client->mmm, NULL, 0, 0, 0);
+  mmm_read_done (client->mmm);
+  client->copy_applied = 0;
+  client->cache_stale = 1;
+  host_linux->scanout = NULL;
+  host_queue_draw (host, NULL);
+}
+
+static void scanout_update (Host *host)
+{
+  HostLinux *host_linux = (void*)host;
+  Client *client = host->client_count ? host->clients[0] : NULL;
+  int i;
+
+  for (i = 0; i < host->client_count; i++)
+    if (host->clients[i] == host_linux->scanout_refused)
+      break;
+  if (i == host->client_count)
+    host_linux->scanout_refused = NULL;
+
+  if (host_linux->scanout)
+  {
+    for (i = 0; i < host->client_count; i++)
+      if (host->clients[i] == host_linux->scanout)
+        break;
+    if (i == host->client_count)
+    {
+      /* it went away */
+      host_linux->scanout = NULL;
+      host_queue_draw (host, NULL);
+    }
+    else if (!scanout_possible (host, host_linux->scanout) ||
+             mmm_host_get_scanout (host_linux->scanout->mmm) != 1)
+      scanout_stop (host);
+  }
+  else if (client && host->single_app)
+  {
+    host_update_visibility (host);
+    if (scanout_possible (host, client))
+      scanout_start (host, client);
+  }
 }
 
 Host *host_linux_new (const char *path, int width, int height)
 {
   Host *host = calloc (sizeof (HostLinux), 1);
   HostLinux *host_linux = (void*)host;
+  EvSource *evdev = NULL;
   host->fbdir = strdup (path);
 
   if (getenv ("DISPLAY"))
@@ -545,8 +987,9 @@ Host *host_linux_new (const char *path, int width, int height)
        free (host_linux);
        return NULL;
      }
-  host_width = host_linux->vinfo.xres;
-  host_height = host_linux->vinfo.yres;
+
+  if (getenv ("MMM_FB_DIRECT") == NULL)
+    fb_setup_pages (host_linux);
 
   host_linux->fb_bits = host_linux->vinfo.bits_per_pixel;
   fprintf (stderr, "fb bits: %i\n", host_linux->fb_bits);
@@ -557,7 +1000,7 @@ Host *host_linux_new (const char *path, int width, int height)
       host_linux->vinfo.green.length +
       host_linux->vinfo.blue.length;
 
-  else if (host_linux->fb_bits == 8)
+  else if (host_linux->fb_bits == 8 && !host_linux->vinfo.grayscale)
   {
     unsigned short red[256],  green[256],  blue[256];
     unsigned short original_red[256];
@@ -587,27 +1030,90 @@ Host *host_linux_new (const char *path, int width, int height)
   }
   
   host_linux->fb_bpp = host_linux->vinfo.bits_per_pixel / 8;
+  host->cache_bpp = host_linux->fb_bpp;
+  host->cache_convert = convert_row;
+  host->copy_rects = 1;
+  host->copy_rect = linux_copy_rect;
+  host_convert_init (&host_linux->convert, host_linux->fb_bits,
+                     host_linux->vinfo.grayscale != 0, 8);
+  host_cursor_init (&host_linux->cursor, host);
 
   host_linux->fb_stride = host_linux->finfo.line_length;
   host_linux->fb_mapped_size = host_linux->finfo.smem_len;
   host_linux->front_buffer = mmap (NULL, host_linux->fb_mapped_size, PROT_READ|PROT_WRITE, MAP_SHARED, host_linux->fb_fd, 0);
   memset (host_linux->front_buffer, 255, host_linux->fb_mapped_size);
 
+  /* compose in system memory, device memory is slow to read from and the
+   * screen tears when drawing into it - fall back to doing so if we must
+   */
+  if (getenv ("MMM_FB_DIRECT") == NULL)
+  {
+    int rotation = host_rotation_from_env ();
+    int rows = rotation % 180 ? host_linux->vinfo.xres : host_linux->vinfo.yres;
+
+    /* rotated, the shadow is laid out as the logical screen */
+    host_linux->rotation = rotation;
+    host_linux->buffer_stride = rotation % 180 ?
+      host_linux->vinfo.yres * host_linux->fb_bpp :
+      host_linux->fb_stride;
+    host_linux->shadow = malloc (host_linux->buffer_stride * rows);
+    host_linux->scanline = malloc (host_linux->buffer_stride);
+    if (rotation)
+      host_linux->strip = malloc (host_linux->buffer_stride * HOST_ROTATE_TILE);
+    if (host_linux->shadow)
+      memset (host_linux->shadow, 255, host_linux->buffer_stride * rows);
+  }
+  if (host_linux->shadow && host_linux->scanline &&
+      (host_linux->strip || !host_linux->rotation))
+  {
+    host_linux->buffer = host_linux->shadow;
+  }
+  else
+  {
+    if (host_linux->rotation)
+      fprintf (stderr, "rotation needs the shadow buffer, not rotating\n");
+    free (host_linux->shadow);
+    free (host_linux->scanline);
+    free (host_linux->strip);
+    host_linux->shadow = host_linux->scanline = host_linux->strip = NULL;
+    host_linux->rotation = 0;
+    host_linux->buffer_stride = host_linux->fb_stride;
+    host_linux->buffer = host_linux->front_buffer;
+    host_linux->fb_pages = 1;
+  }
+
+  host_width = host_linux->rotation % 180 ? host_linux->vinfo.yres :
+                                            host_linux->vinfo.xres;
+  host_height = host_linux->rotation % 180 ? host_linux->vinfo.xres :
+                                             host_linux->vinfo.yres;
   if (host->fullscreen)
   {
-    host->width = host_linux->vinfo.xres;
+    host->width = host_width;
     host->stride = host->width * host->bpp;
-    host->height = host_linux->vinfo.yres;
+    host->height = host_height;
   }
 
   host_clear_dirt (host);
 
-  EvSource *kb = evsource_kb_new ();
-  EvSource *mice = evsource_mice_new ();
-  host_add_evsource (host, kb);
-  host_add_evsource (host, mice);
-  kb->priv = host;
-  mice->priv = host;
+  /* evdev devices when we may read them, otherwise the keys typed on the
+   * terminal and the mouse as /dev/input/mice presents it
+   */
+  if (!getenv ("MMM_EVDEV") || strcmp (getenv ("MMM_EVDEV"), "0"))
+    evdev = evsource_evdev_new (host_linux->rotation);
+  if (evdev)
+  {
+    host_add_evsource (host, evdev);
+    evdev->priv = host;
+  }
+  else
+  {
+    EvSource *kb = evsource_kb_new ();
+    EvSource *mice = evsource_mice_new ();
+    host_add_evsource (host, kb);
+    host_add_evsource (host, mice);
+    kb->priv = host;
+    mice->priv = host;
+  }
 
   return host;
 }
@@ -656,6 +1162,7 @@ void linux_warp_cursor (Host *host, int x, int y)
 static int main_linux (const char *path, int single)
 {
   Host *host;
+  int busy = 0;
 
   host = host_linux_new (path, -1, -1);
   host_linux = (void*) host;
@@ -669,18 +1176,22 @@ static int main_linux (const char *path, int single)
   {
     int got_event;
 
+    /* sleep until there is input, a change among the clients or they
+     * are due to be polled for damage - unless we just drew a frame.
+     */
+    host_wait (host, busy ? 0 : -1);
     got_event = event_check_pending (host);
     host_idle_check (host);
-    host_monitor_dir (host);
+    host_stats_messages (host);
+    scanout_update (host);
 
-    if (got_event || (host_is_dirty (host) && host_linux->vt_active))
+    busy = got_event || (host_is_dirty (host) && host_linux->vt_active);
+    if (busy)
     {
       int warp = 0;
       double px, py;
-      MmmList *l;
-
-      if (!host->single_app)
-        host->focused = NULL;
+      int i;
+      long start;
 
       _mmm_get_coords (NULL, &px, &py);
 
@@ -693,26 +1204,77 @@ static int main_linux (const char *path, int single)
         linux_warp_cursor (host, px, py);
       }
 
+      if (host_linux->scanout)
+      {
+        /* the client has drawn to the device itself */
+        if (host_is_dirty (host))
+          scanout_frame (host);
+        host_clear_dirt (host);
+        host_trace_presented (host);
+        host_stats_frame (host);
+        continue;
+      }
+
       if (host_is_dirty (host))
       {
-        undraw_cursor (host);
-        for (l = host->clients; l; l = l->next)
+        int direct = host_linux->buffer == host_linux->front_buffer;
+        MmmRectangle hud;
+
+        /* the HUD is drawn over whatever else changes */
+        host_stats_hud_rect (host, &hud);
+        if (host_stats_hud_shown ())
+          host_add_dirt (host, hud.x, hud.y,
+                         hud.x + hud.width, hud.y + hud.height);
+
+        host_update_visibility (host);
+        if (direct)
+          host_cursor_undraw (&host_linux->cursor, host_linux->buffer,
+                              host_linux->buffer_stride);
+        if (host_dirt_is_translucent (host))
+          clear_dirt (host);
+        for (i = 0; i < host->client_count; i++)
         {
-          render_client (host, l->data, px, py);
+          int64_t trace_start = mmm_trace_begin ();
+          start = mmm_ticks ();
+          render_client (host, host->clients[i]);
+          host_stats_client (host->clients[i], mmm_ticks () - start);
+          mmm_trace_end (trace_start, "render",
+                         mmm_get_title (host->clients[i]->mmm));
         }
+        if (host_stats_hud_shown ())
+          host_stats_hud_draw (host, host_linux->buffer +
+                               hud.y * host_linux->buffer_stride +
+                               hud.x * host_linux->fb_bpp,
+                               host_linux->buffer_stride);
+        if (direct)
+          host_stats_bytes ((long)(host->dirty_xmax - host->dirty_xmin) *
+                            (host->dirty_ymax - host->dirty_ymin) *
+                            host_linux->fb_bpp);
+        fb_add_damage (host, host->dirty_xmin, host->dirty_ymin,
+                             host->dirty_xmax, host->dirty_ymax);
         host_clear_dirt (host);
-        draw_cursor (host, px, py);
       }
-      else
+      start = mmm_ticks ();
+      if (host_linux->pointer_seen)
+        move_cursor (host, px, py);
+      host_stats_add (HOST_STAT_CURSOR, mmm_ticks () - start);
       {
-        undraw_cursor (host);
-        draw_cursor (host, px, py);
+        int64_t trace_start = mmm_trace_begin ();
+        start = mmm_ticks ();
+        fb_present (host);
+        host_stats_add (HOST_STAT_PRESENT, mmm_ticks () - start);
+        mmm_trace_end (trace_start, "present", NULL);
       }
+      host_trace_presented (host);
+      host_stats_frame (host);
     }
-    else
-    {
-      usleep (10000);
-    }
+  }
+  if (host_linux->scanout)
+    mmm_host_set_scanout (host_linux->scanout->mmm, NULL, 0, 0, 0);
+  if (host_linux->fb_pages == 2)
+  {
+    host_linux->vinfo.yoffset = 0;
+    ioctl (host_linux->fb_fd, FBIOPAN_DISPLAY, &host_linux->vinfo);
   }
   ioctl(host_linux->tty, KDSETMODE, KD_TEXT);
 
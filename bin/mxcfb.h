@@ -78,6 +78,11 @@ struct mxcfb_rect {
 #define UPDATE_MODE_PARTIAL			0x0
 #define UPDATE_MODE_FULL			0x1
 
+#define WAVEFORM_MODE_INIT			0x0
+#define WAVEFORM_MODE_DU			0x1
+#define WAVEFORM_MODE_GC16			0x2
+#define WAVEFORM_MODE_GC4			0x3
+#define WAVEFORM_MODE_A2			0x4
 #define WAVEFORM_MODE_AUTO			257
 
 #define TEMP_USE_AMBIENT			0x1000
@@ -25,8 +25,14 @@ OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
 #include <unistd.h>
 #include <SDL/SDL.h>
 #include <sys/stat.h>
+#include <poll.h>
 #include <errno.h>
 #include "host.h"
+#include "host-composite.h"
+#include "host-blend.h"
+#include "host-scale.h"
+#include "host-trace.h"
+#include "host-stats.h"
 
 typedef struct _HostSDL   HostSDL;
 
@@ -38,7 +44,7 @@ struct _HostSDL
 
 static int baseflags = SDL_SWSURFACE;
 
-static void render_client (Host *host, Client *client, float ptr_x, float ptr_y)
+static void render_client (Host *host, Client *client)
 {
   HostSDL *host_sdl = (void*)host;
   SDL_Surface *screen = host_sdl->screen;
@@ -51,22 +57,40 @@ static void render_client (Host *host, Client *client, float ptr_x, float ptr_y)
   if (client->pid == getpid ())
     return;
 
+  if (client->occluded)
+  {
+    host_client_skip (host, client);
+    return;
+  }
+
   int cwidth, cheight;
 
-  const unsigned char *pixels = mmm_get_buffer_read (client->mmm,
+  const unsigned char *pixels = host_client_read (host, client,
       &width, &height, &rowstride);
   int x, y;
 
-  x = mmm_get_x (client->mmm);
-  y = mmm_get_y (client->mmm);
+  x = client->x;
+  y = client->y;
 
-  if (ptr_x >= x && ptr_x < x + width &&
-      ptr_y >= y && ptr_y < y + height)
-    {
-      host->focused = client;
-    }
-
-  if (pixels && width && height)
+  if (pixels && width && height && client->scale != 1.0f)
+  {
+    HostScale scale = {pixels, rowstride, width, height, 4, x, y,
+                       client->scale, client->scale_filter,
+                       client->translucent};
+    int x0 = x > host->dirty_xmin ? x : host->dirty_xmin;
+    int y0 = y > host->dirty_ymin ? y : host->dirty_ymin;
+    int x1 = x + client->width;
+    int y1 = y + client->height;
+
+    if (x0 < 0) x0 = 0;
+    if (y0 < 0) y0 = 0;
+    if (x1 > host->dirty_xmax) x1 = host->dirty_xmax;
+    if (y1 > host->dirty_ymax) y1 = host->dirty_ymax;
+    if (x1 > host->width)  x1 = host->width;
+    if (y1 > host->height) y1 = host->height;
+    host_scale_rect (&scale, screen->pixels, host->stride, x0, y0, x1, y1);
+  }
+  else if (pixels && width && height)
   {
     int front_offset = y * host->stride + x * host->bpp;
     uint8_t *dst = screen->pixels + front_offset;
@@ -82,10 +106,7 @@ static void render_client (Host *host, Client *client, float ptr_x, float ptr_y)
 
     if (end_scan < host->dirty_ymin ||
         x + width < host->dirty_xmin)
-    {
-      mmm_read_done (client->mmm);
       return;
-    }
 
     if (start_scan < host->dirty_ymin)
       start_scan = host->dirty_ymin;
@@ -119,14 +140,17 @@ static void render_client (Host *host, Client *client, float ptr_x, float ptr_y)
     {
       if (dst >= (uint8_t*)screen->pixels &&
           dst < ((uint8_t*)screen->pixels) + (host->stride * host->height) - copy_count * 4)
-        memcpy (dst, src, copy_count * 4);
+      {
+        if (client->translucent)
+          host_blend_over (dst, src, copy_count);
+        else
+          memcpy (dst, src, copy_count * 4);
+      }
       dst += host->stride;
       src += rowstride;
     }
 
     /* XXX: pass a copy to video-encoder thread, or directly encode */
-
-    mmm_read_done (client->mmm);
   }
 
   mmm_host_get_size (client->mmm, &cwidth, &cheight);
@@ -233,6 +257,7 @@ Host *host_sdl_new (const char *path, int width, int height)
   host->height = height;
   host->bpp = 4;
   host->stride = host->width * host->bpp;
+  host->copy_rects = 1;
 
   host_sdl->screen =  SDL_SetVideoMode (host->width, host->height, 32, baseflags | SDL_RESIZABLE);
 
@@ -286,6 +311,35 @@ mmfb_unichar_to_utf8 (unsigned int  ch,
     return 0;
 }
 
+/* the host's fds - inotify on fbdir and the pidfds of clients - are waited
+ * on in a thread that turns their readiness, or the timeout for polling
+ * clients for damage, into an SDL_USEREVENT; letting the main loop sleep
+ * in SDL_WaitEvent. The thread waits on watch_sem until the main loop has
+ * dealt with it.
+ */
+static SDL_sem *watch_sem = NULL;
+static int      watch_timeout = -1;
+static int      watch_woken = 0;
+
+static int host_watch_thread (void *data)
+{
+  Host *host = data;
+  struct pollfd pfd = {host_get_fd (host), POLLIN, 0};
+
+  while (!host_has_quit)
+  {
+    if (poll (&pfd, 1, watch_timeout) >= 0)
+    {
+      SDL_Event event;
+      memset (&event, 0, sizeof (event));
+      event.type = SDL_USEREVENT;
+      SDL_PushEvent (&event);
+      SDL_SemWait (watch_sem);
+    }
+  }
+  return 0;
+}
+
 static int sdl_check_events (Host *host)
 {
   HostSDL *host_sdl = (void*)host;
@@ -296,6 +350,9 @@ static int sdl_check_events (Host *host)
   {
     switch (event.type)
     {
+      case SDL_USEREVENT:
+        watch_woken = 1;
+        break;
       case SDL_MOUSEMOTION:
         {
           if (host->pointer_down[0])
@@ -307,8 +364,9 @@ static int sdl_check_events (Host *host)
                  (float)event.motion.x,
                  (float)event.motion.y);
 
+          host_pointer_focus (host, event.motion.x, event.motion.y);
           if (host->focused)
-            mmm_add_event (host->focused->mmm, buf);
+            host_client_add_event (host, host->focused, buf);
         }
         break;
       case SDL_MOUSEBUTTONDOWN:
@@ -316,8 +374,9 @@ static int sdl_check_events (Host *host)
           sprintf (buf, "mouse-press %.0f %.0f",
                (float)event.button.x,
                (float)event.button.y);
+          host_pointer_focus (host, event.button.x, event.button.y);
           if (host->focused)
-            mmm_add_event (host->focused->mmm, buf);
+            host_client_add_event (host, host->focused, buf);
           host->pointer_down[0] = 1;
         }
         break;
@@ -327,8 +386,9 @@ static int sdl_check_events (Host *host)
                (float)event.button.x,
                (float)event.button.y);
 
+          host_pointer_focus (host, event.button.x, event.button.y);
           if (host->focused)
-            mmm_add_event (host->focused->mmm, buf);
+            host_client_add_event (host, host->focused, buf);
           host->pointer_down[0] = 0;
         }
         break;
@@ -405,7 +465,7 @@ static int sdl_check_events (Host *host)
           }
           if (name)
             if (host->focused)
-              mmm_add_event (host->focused->mmm, name);
+              host_client_add_event (host, host->focused, name);
         }
         break;
       case SDL_VIDEORESIZE:
@@ -417,6 +477,7 @@ static int sdl_check_events (Host *host)
         host->width  = event.resize.w;
         host->height = event.resize.h;
         host->stride = host->width * host->bpp;
+        host->stacking_changed = 1;
 
         if (host->single_app && host->focused)
           mmm_host_set_size (host->focused->mmm,
@@ -430,16 +491,13 @@ static int sdl_check_events (Host *host)
     }
     got_event = 1;
   }
-  if (!got_event)
-  {
-    usleep (16000);
-  }
   return got_event;
 }
 
 static int main_sdl (const char *path, int single)
 {
   Host *host;
+  int busy = 0;
   host     = host_sdl_new (path, 1024, 768);
   HostSDL *host_sdl = (void*)host;
   host_sdl = (void*) host;
@@ -448,33 +506,66 @@ static int main_sdl (const char *path, int single)
 
   audio_init_alsa (host);
 
+  host_monitor_dir (host);
+  watch_sem = SDL_CreateSemaphore (0);
+  watch_timeout = host_poll_interval (host);
+  SDL_CreateThread (host_watch_thread, host);
+
   while (!host_has_quit)
   {
     int got_event;
 
+    if (!busy)
+      SDL_WaitEvent (NULL);
+
     got_event = sdl_check_events (host);
+    host_wait (host, 0);
+    if (watch_woken)
+    {
+      watch_woken = 0;
+      watch_timeout = host_poll_interval (host);
+      SDL_SemPost (watch_sem);
+    }
     host_idle_check (host);
-    host_monitor_dir (host);
 
+    busy = got_event;
     if (host_is_dirty (host)) {
-      int x, y;
-      SDL_GetMouseState(&x, &y);
+      int i;
 
-      if (!host->single_app)
-        host->focused = NULL;
+      host_update_visibility (host);
 
-      MmmList *l;
-      for (l = host->clients; l; l = l->next)
+      if (host_dirt_is_translucent (host))
+      {
+        SDL_Rect rect = {host->dirty_xmin, host->dirty_ymin,
+                         host->dirty_xmax - host->dirty_xmin,
+                         host->dirty_ymax - host->dirty_ymin};
+        SDL_FillRect (host_sdl->screen, &rect, 0);
+      }
+      for (i = 0; i < host->client_count; i++)
+      {
+        int64_t start = mmm_trace_begin ();
+        long ticks = mmm_ticks ();
+        render_client (host, host->clients[i]);
+        host_stats_client (host->clients[i], mmm_ticks () - ticks);
+        mmm_trace_end (start, "render",
+                       mmm_get_title (host->clients[i]->mmm));
+      }
       {
-        render_client (host, l->data, x, y);
+        int64_t start = mmm_trace_begin ();
+        long ticks = mmm_ticks ();
+        SDL_UpdateRect(host_sdl->screen, 0,0,0,0);
+        host_stats_add (HOST_STAT_PRESENT, mmm_ticks () - ticks);
+        mmm_trace_end (start, "present", NULL);
       }
-      SDL_UpdateRect(host_sdl->screen, 0,0,0,0);
+      host_trace_presented (host);
+      host_stats_frame (host);
       host_clear_dirt (host);
+      busy = 1;
     }
     else
     {
       if (host->single_app && !host->focused)
-        host->focused = host->clients?host->clients->data:NULL;
+        host->focused = host->client_count?host->clients[0]:NULL;
       if (host->single_app && host->focused)
       {
         static char *title = NULL;
@@ -485,8 +576,6 @@ static int main_sdl (const char *path, int single)
           SDL_WM_SetCaption (title, "mmm");
         }
       }
-      if (!got_event)
-        usleep (5000);
     }
   }
 
@@ -25,8 +25,11 @@ OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
 #include <unistd.h>
 #include <SDL.h>
 #include <sys/stat.h>
+#include <poll.h>
 #include <errno.h>
 #include "host.h"
+#include "host-trace.h"
+#include "host-stats.h"
 
 typedef struct _HostSDL   HostSDL;
 
@@ -39,7 +42,7 @@ struct _HostSDL
   SDL_Texture  *texture;
 };
 
-static void render_client (Host *host, Client *client, float ptr_x, float ptr_y)
+static void render_client (Host *host, Client *client)
 {
   HostSDL *host_sdl = (void*)host;
   int width, height, rowstride;
@@ -49,18 +52,13 @@ static void render_client (Host *host, Client *client, float ptr_x, float ptr_y)
 
   int cwidth, cheight;
 
-  const unsigned char *pixels = mmm_get_buffer_read (client->mmm,
+  /* the texture holds the last frame, if the client is busy drawing we
+   * leave it as is and pick up the frame once it is committed
+   */
+  const unsigned char *pixels = mmm_get_buffer_read_nowait (client->mmm,
       &width, &height, &rowstride);
-  int x, y;
-
-  x = mmm_get_x (client->mmm);
-  y = mmm_get_y (client->mmm);
-
-  if (ptr_x >= x && ptr_x < x + width &&
-      ptr_y >= y && ptr_y < y + height)
-    {
-      host->focused = client;
-    }
+  if (!pixels)
+    client->stalls++;
 
   //mmm_host_get_size (client->mmm, &cwidth, &cheight);
   if (pixels && width && height)
@@ -72,6 +70,7 @@ static void render_client (Host *host, Client *client, float ptr_x, float ptr_y)
       //   if it is the client and not the user changing size
       host->width = width;
       host->height = height;
+      host->stacking_changed = 1;
       SDL_DestroyTexture (host_sdl->texture);
       host_sdl->texture = SDL_CreateTexture(host_sdl->renderer,
                                SDL_PIXELFORMAT_ARGB8888,
@@ -88,11 +87,18 @@ static void render_client (Host *host, Client *client, float ptr_x, float ptr_y)
 
     SDL_RenderClear(host_sdl->renderer);
     SDL_RenderCopy(host_sdl->renderer, host_sdl->texture, NULL, NULL);
-    SDL_RenderPresent(host_sdl->renderer);
+    host_trace_frame (client);
+    {
+      int64_t start = mmm_trace_begin ();
+      SDL_RenderPresent(host_sdl->renderer);
+      mmm_trace_end (start, "present", NULL);
+    }
+    host_trace_presented (host);
     //SDL_DestroyTexture (texture);
     //SDL_FreeSurface (surface);
-    mmm_read_done (client->mmm);
   }
+  if (pixels)
+    mmm_read_done (client->mmm);
 
   mmm_host_get_size (client->mmm, &cwidth, &cheight);
 
@@ -267,18 +273,54 @@ mmfb_unichar_to_utf8 (unsigned int  ch,
 static int lctrl = 0;
 static int rctrl = 0;
 
+/* the host's fds - inotify on fbdir and the pidfds of clients - are waited
+ * on in a thread that turns their readiness, or the timeout for polling
+ * clients for damage, into an SDL_USEREVENT; letting the main loop sleep
+ * in SDL_WaitEvent. The thread waits on watch_sem until the main loop has
+ * dealt with it.
+ */
+static SDL_sem *watch_sem = NULL;
+static int      watch_timeout = -1;
+static int      watch_woken = 0;
+
+static int host_watch_thread (void *data)
+{
+  Host *host = data;
+  struct pollfd pfd = {host_get_fd (host), POLLIN, 0};
+
+  while (!host_has_quit)
+  {
+    if (poll (&pfd, 1, watch_timeout) >= 0)
+    {
+      SDL_Event event;
+      memset (&event, 0, sizeof (event));
+      event.type = SDL_USEREVENT;
+      SDL_PushEvent (&event);
+      SDL_SemWait (watch_sem);
+    }
+  }
+  return 0;
+}
+
 static int sdl_check_events (Host *host)
 {
   //HostSDL *host_sdl = (void*)host;
   SDL_Event event;
   int got_event = 0;
   char buf[64];
+  int64_t time;
   while (SDL_PollEvent (&event))
   {
+    /* SDL stamps events in milliseconds since it was initialized */
+    time = mmm_timestamp () -
+           (int64_t)(SDL_GetTicks () - event.common.timestamp) * 1000;
     //const uint8_t *state = SDL_GetKeyboardState(NULL);
 
     switch (event.type)
     {
+      case SDL_USEREVENT:
+        watch_woken = 1;
+        break;
       case SDL_WINDOWEVENT:
 	{
 	  if (event.window.event == SDL_WINDOWEVENT_RESIZED)
@@ -286,6 +328,7 @@ static int sdl_check_events (Host *host)
             host->width  = event.window.data1;
             host->height = event.window.data2;
             host->stride = host->width * host->bpp;
+            host->stacking_changed = 1;
 
             if (host->single_app && host->focused)
 	    {
@@ -309,8 +352,9 @@ static int sdl_check_events (Host *host)
                  (float)event.motion.x,
                  (float)event.motion.y);
 
+          host_pointer_focus (host, event.motion.x, event.motion.y);
           if (host->focused)
-            mmm_add_event (host->focused->mmm, buf);
+            host_client_add_event_at (host, host->focused, buf, time);
         }
         break;
       case SDL_MOUSEBUTTONDOWN:
@@ -318,8 +362,9 @@ static int sdl_check_events (Host *host)
           sprintf (buf, "mouse-press %.0f %.0f",
                (float)event.button.x,
                (float)event.button.y);
+          host_pointer_focus (host, event.button.x, event.button.y);
           if (host->focused)
-            mmm_add_event (host->focused->mmm, buf);
+            host_client_add_event_at (host, host->focused, buf, time);
           host->pointer_down[0] = 1;
         }
         break;
@@ -329,8 +374,9 @@ static int sdl_check_events (Host *host)
                (float)event.button.x,
                (float)event.button.y);
 
+          host_pointer_focus (host, event.button.x, event.button.y);
           if (host->focused)
-            mmm_add_event (host->focused->mmm, buf);
+            host_client_add_event_at (host, host->focused, buf, time);
           host->pointer_down[0] = 0;
         }
         break;
@@ -341,7 +387,7 @@ static int sdl_check_events (Host *host)
 
           if (host->focused)
 	  {
-            mmm_add_event (host->focused->mmm, name);
+            host_client_add_event_at (host, host->focused, name, time);
 	  }
 	}
 	break;
@@ -424,7 +470,7 @@ static int sdl_check_events (Host *host)
 	    if (strcmp (name, "space"))
 	    {
               if (host->focused)
-                mmm_add_event (host->focused->mmm, name);
+                host_client_add_event_at (host, host->focused, name, time);
 	    }
           }
 	  }
@@ -447,41 +493,50 @@ static int main_sdl (const char *path, int single)
 
   audio_init_alsa (host); // XXX : look into implement audio output using SDL2 itself instead
 
-  int sleep_time = 500;
+  host_monitor_dir (host);
+  watch_sem = SDL_CreateSemaphore (0);
+  watch_timeout = host_poll_interval (host);
+  SDL_CreateThread (host_watch_thread, "mmm-watch", host);
 
-  int iter = 0;
+  int busy = 0;
   while (!host_has_quit)
   {
     int got_event = 0;
 
+    if (!busy)
+      SDL_WaitEvent (NULL);
+
     got_event = sdl_check_events (host);
+    host_wait (host, 0);
+    if (watch_woken)
+    {
+      watch_woken = 0;
+      watch_timeout = host_poll_interval (host);
+      SDL_SemPost (watch_sem);
+    }
     host_idle_check (host); // this update if the host is dirty
 
-    if (iter ++ % 10 == 0) // we do not need to do it frequently
-      host_monitor_dir (host);
-
-    if (got_event)
-      sleep_time = 10000;
-
     if (host_is_dirty (host)) {
-      int x, y;
-      SDL_GetMouseState(&x, &y);
+      int i;
 
-      if (!host->single_app)
-        host->focused = NULL;
-
-      MmmList *l;
-      for (l = host->clients; l; l = l->next)
+      for (i = 0; i < host->client_count; i++)
       {
-        render_client (host, l->data, x, y);
+        int64_t start = mmm_trace_begin ();
+        long ticks = mmm_ticks ();
+        /* presenting is part of rendering a client here */
+        render_client (host, host->clients[i]);
+        host_stats_client (host->clients[i], mmm_ticks () - ticks);
+        mmm_trace_end (start, "render",
+                       mmm_get_title (host->clients[i]->mmm));
       }
+      host_stats_frame (host);
       host_clear_dirt (host);
       got_event = 1;
     }
     //else
     {
       if (host->single_app && !host->focused)
-        host->focused = host->clients?host->clients->data:NULL;
+        host->focused = host->client_count?host->clients[0]:NULL;
       if (host->single_app && host->focused)
       {
         static char *title = NULL;
@@ -493,19 +548,8 @@ static int main_sdl (const char *path, int single)
           //SDL_WM_SetCaption (title, "mmm");
         }
       }
-      if (got_event)
-      {
-	if (sleep_time > 30000)
-	  sleep_time = 30000;
-      }
-      else
-      {
-	if (sleep_time > 1500000)
-	  sleep_time = 1500000;
-        usleep (sleep_time);
-	sleep_time *= 1.5;
-      }
     }
+    busy = got_event;
   }
 
   if (host->single_app)
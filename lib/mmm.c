@@ -30,9 +30,64 @@
 #include <stdint.h>
 #include <sys/time.h>
 #include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+
+#if defined(__has_include)
+#if __has_include(<linux/userfaultfd.h>)
+#include <linux/userfaultfd.h>
+#endif
+#endif
+
+/* for finding out which pages a client wrote, MMM_FLAG_AUTO_DAMAGE - newer
+ * than what many kernel headers carry
+ */
+#ifdef UFFDIO_API
+#ifndef UFFD_USER_MODE_ONLY
+#define UFFD_USER_MODE_ONLY 1
+#endif
+#ifndef UFFD_FEATURE_WP_HUGETLBFS_SHMEM
+#define UFFD_FEATURE_WP_HUGETLBFS_SHMEM (1 << 12)
+#endif
+#ifndef UFFD_FEATURE_WP_UNPOPULATED
+#define UFFD_FEATURE_WP_UNPOPULATED     (1 << 13)
+#endif
+#ifndef UFFD_FEATURE_WP_ASYNC
+#define UFFD_FEATURE_WP_ASYNC           (1 << 15)
+#endif
+
+/* struct page_region and struct pm_scan_arg of linux/fs.h */
+typedef struct MmmPageRegion {
+  uint64_t start, end, categories;
+} MmmPageRegion;
+
+typedef struct MmmScanArg {
+  uint64_t size, flags, start, end, walk_end, vec, vec_len, max_pages;
+  uint64_t category_inverted, category_mask, category_anyof_mask, return_mask;
+} MmmScanArg;
+
+#define MMM_PAGEMAP_SCAN        _IOWR('f', 16, MmmScanArg)
+#define MMM_PAGE_IS_WRITTEN     (1 << 1)
+#define MMM_PM_SCAN_WP_MATCHING   (1 << 0)
+#define MMM_PM_SCAN_CHECK_WPASYNC (1 << 1)
+#endif
+
+#define MMM_PAGEMAP_SOFT_DIRTY  (1ULL << 55)
 
 #define MMM_MAX_EVENT  1024
 
+/* bumped for protocol additions hosts need to know a client supports:
+ *   1 - rings the doorbell of the host on mmm_write_done
+ *   2 - draws straight to the display device when the host asks it to
+ */
+#define MMM_CLIENT_VERSION 2
+
+/* and in server_version, for what the host supports:
+ *   1 - applies the copies recorded with mmm_copy_rect
+ */
+#define MMM_HOST_COPIES 1
+
 typedef enum {
   MMM_INITIALIZING = 0,
   MMM_NEUTRAL,
@@ -73,9 +128,13 @@ typedef struct MmmHeader {
  uint32_t   server_version;  /* */
  int32_t    pid;             /* C (by _convention_ 64bit systems also have 32bit pids)*/
  int        lock;            /* */
+ int32_t    doorbell;        /*  H slot to write to the doorbell fifo, 0 for none */
+ int32_t    doorbell_rung;   /* CH set when ringing, cleared by host before reading */
+ uint32_t   doorbell_serial; /*  H bumped with each slot given, a restarted host has
+                                   a new fifo that the client has to reopen */
  /* revision?                   */
  /* flags.. */
- uint32_t   pad[32];
+ uint32_t   pad[29];
 } MmmHeader;
 
 typedef struct MmmFb {
@@ -101,7 +160,24 @@ typedef struct MmmFb {
  int32_t    damage_height;   /* CH */
 
  double     z;               /*  H used for persisting stacking order */
- uint32_t   pad[30];
+
+ int64_t    input_time;      /* CH time of newest event the frame responds to, 0 for none */
+ int64_t    frame_time;      /* CH when that frame was committed */
+
+ int32_t    scanout;         /* HC 1 when the client is to draw to scanout_device,
+                                   set to -1 by the client if it cannot */
+ int32_t    scanout_stride;  /*  H byte offset between rows on the device */
+ int64_t    scanout_offset;  /*  H of the pixels of the client in the device */
+ int64_t    scanout_size;    /*  H bytes of the device to map */
+ char       scanout_device[32]; /* H */
+
+ int32_t    copy_x;          /* C  source of pixels moved by copy_dx, copy_dy */
+ int32_t    copy_y;          /* C  before the damage was drawn, copy_width */
+ int32_t    copy_width;      /* C  is 0 when nothing was moved */
+ int32_t    copy_height;     /* C */
+ int32_t    copy_dx;         /* C */
+ int32_t    copy_dy;         /* C */
+ uint32_t   pad[6];
 } MmmFb;
 
 /* XXX: all of event/message/pcm can share more code and logic if using
@@ -116,6 +192,11 @@ typedef struct MmmEvents {
   uint8_t        buffer[MMM_MAX_EVENT][128]; /* S circular list of events    */
 } MmmEvents;
 
+/* the last 8 bytes of an event slot hold the time of the input that
+ * caused it, leaving room for 119 chars of event string.
+ */
+#define MMM_EVENT_TIME_OFFSET  (128 - sizeof (int64_t))
+
 typedef struct MmmMessages {
   MmmBlock       block;
   int16_t        read;      /* H  last message_no which has been read    */
@@ -181,6 +262,30 @@ struct Mmm_
   MmmPcm      *pcm;
   MmmEvents   *events;
   MmmMessages *messages;
+
+  int          doorbell_fd;  /* client side, the fifo of the host, or -1 */
+  uint32_t     doorbell_serial; /* client side, of the slot doorbell_fd is for */
+
+  int64_t      event_time;   /* client side, of the last event returned */
+  int64_t      input_time;   /* client side, newest event read since the
+                                last frame was committed */
+  int64_t      draw_start;   /* client side, trace span of the frame drawn */
+  uint8_t     *drawing;      /* client side, the pixels handed out to draw */
+  int          drawing_stride;
+
+  int          auto_damage;  /* client side, MmmDamageTracking */
+  int          uffd;         /* write protecting the pixels, or -1 */
+  int          pagemap_fd;
+  void        *tracked_shm;  /* the mapping the pixels are tracked in */
+  int          tracked_size;
+  uint8_t     *tracked_fb;   /* and the layout of the pixels tracked */
+  int          tracked_bytes;
+  int          tracked;      /* writes since the last frame are known, -1
+                                when just armed - that frame is all damage */
+
+  uint8_t     *scanout_map;  /* client side, the mapped display device */
+  int64_t      scanout_size;
+  char         scanout_device[32];
 };
 
 #define U64_CONSTANT(str) (*((uint64_t*)str))
@@ -222,6 +327,171 @@ long mmm_ticks (void)
 #undef usecs
 }
 
+int64_t mmm_timestamp (void)
+{
+  struct timeval now;
+  gettimeofday (&now, NULL);
+  return now.tv_sec * (int64_t)1000000 + now.tv_usec;
+}
+
+/* protocol tracing, the latest MMM_TRACE_EVENTS spans of the process are
+ * kept in a ring that threads claim entries of atomically, and appended
+ * to the file named by MMM_TRACE at exit.
+ */
+#define MMM_TRACE_EVENTS (1 << 16)
+
+typedef struct MmmTraceEvent {
+  int64_t     ts;
+  int64_t     dur;       /* -1 for instants */
+  const char *name;
+  int32_t     tid;
+  char        arg[28];
+} MmmTraceEvent;
+
+static int            trace_state = -1; /* -1 until configured */
+static MmmTraceEvent *trace_ring;
+static unsigned int   trace_pos;
+static __thread int   trace_tid;
+
+static void mmm_trace_write_string (FILE *file, const char *str)
+{
+  for (; *str; str++)
+  {
+    if (*str == '"' || *str == '\\')
+      fputc ('\\', file);
+    fputc ((unsigned char)*str < ' ' ? '?' : *str, file);
+  }
+}
+
+static void mmm_trace_dump (void)
+{
+  const char *path = getenv ("MMM_TRACE");
+  unsigned int pos = trace_pos;
+  unsigned int i;
+  char comm[32] = "mmm";
+  int pid = getpid ();
+  int first = 1;
+  FILE *file;
+  int fd;
+
+  /* the first process creates the file and opens the array, the closing
+   * ] is optional in the trace-event format so others can keep appending
+   */
+  fd = open (path, O_WRONLY | O_APPEND | O_CREAT | O_EXCL, 0644);
+  if (fd < 0)
+  {
+    first = 0;
+    fd = open (path, O_WRONLY | O_APPEND);
+  }
+  if (fd < 0 || !(file = fdopen (fd, "a")))
+  {
+    fprintf (stderr, "mmm failed writing trace to %s\n", path);
+    return;
+  }
+  flock (fd, LOCK_EX);
+
+  {
+    FILE *comm_file = fopen ("/proc/self/comm", "r");
+    if (comm_file)
+    {
+      if (fgets (comm, sizeof (comm), comm_file))
+        comm[strcspn (comm, "\n")] = 0;
+      fclose (comm_file);
+    }
+  }
+
+  if (first)
+    fprintf (file, "[\n");
+  fprintf (file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%i,"
+           "\"args\":{\"name\":\"", pid);
+  mmm_trace_write_string (file, comm);
+  fprintf (file, "\"}},\n");
+
+  for (i = pos > MMM_TRACE_EVENTS ? pos - MMM_TRACE_EVENTS : 0; i < pos; i++)
+  {
+    MmmTraceEvent *event = &trace_ring[i % MMM_TRACE_EVENTS];
+    if (!event->name)
+      continue;
+    fprintf (file, "{\"name\":\"%s\",\"pid\":%i,\"tid\":%i,\"ts\":%lli,",
+             event->name, pid, event->tid, (long long)event->ts);
+    if (event->dur < 0)
+      fprintf (file, "\"ph\":\"i\",\"s\":\"t\"");
+    else
+      fprintf (file, "\"ph\":\"X\",\"dur\":%lli", (long long)event->dur);
+    if (event->arg[0])
+    {
+      fprintf (file, ",\"args\":{\"detail\":\"");
+      mmm_trace_write_string (file, event->arg);
+      fprintf (file, "\"}");
+    }
+    fprintf (file, "},\n");
+  }
+  fflush (file);
+  flock (fd, LOCK_UN);
+  fclose (file);
+}
+
+static int mmm_trace_enabled (void)
+{
+  if (trace_state >= 0)
+    return trace_state;
+
+  if (getenv ("MMM_TRACE") && getenv ("MMM_TRACE")[0])
+  {
+    MmmTraceEvent *ring = calloc (MMM_TRACE_EVENTS, sizeof (MmmTraceEvent));
+    if (__sync_bool_compare_and_swap (&trace_ring, NULL, ring))
+      atexit (mmm_trace_dump);
+    else
+      free (ring);
+    trace_state = 1;
+  }
+  else
+    trace_state = 0;
+  return trace_state;
+}
+
+static void mmm_trace_add (int64_t ts, int64_t dur,
+                           const char *name, const char *arg)
+{
+  unsigned int pos = __sync_fetch_and_add (&trace_pos, 1);
+  MmmTraceEvent *event = &trace_ring[pos % MMM_TRACE_EVENTS];
+
+  if (!trace_tid)
+    trace_tid = syscall (SYS_gettid);
+  event->ts = ts;
+  event->dur = dur;
+  event->tid = trace_tid;
+  if (arg)
+  {
+    strncpy (event->arg, arg, sizeof (event->arg) - 1);
+    event->arg[sizeof (event->arg) - 1] = 0;
+  }
+  else
+    event->arg[0] = 0;
+  event->name = name;
+}
+
+int64_t mmm_trace_begin (void)
+{
+  if (!mmm_trace_enabled ())
+    return 0;
+  return mmm_timestamp ();
+}
+
+void mmm_trace_end (int64_t start, const char *name, const char *arg)
+{
+  if (!start)
+    return;
+  mmm_trace_add (start, mmm_timestamp () - start, name, arg);
+}
+
+void mmm_trace_mark (const char *name, const char *arg)
+{
+  if (!mmm_trace_enabled ())
+    return;
+  mmm_trace_add (mmm_timestamp (), -1, name, arg);
+}
+
 int
 mmm_wait_neutral (Mmm *fb)
 {
@@ -240,11 +510,279 @@ mmm_set_state (Mmm *fb, MmmFlipState state)
   return 1;
 }
 
+typedef enum {
+  MMM_TRACK_OFF = 0,
+  MMM_TRACK_UFFD,        /* async userfaultfd write protection, and
+                            PAGEMAP_SCAN collecting and re-protecting */
+  MMM_TRACK_SOFT_DIRTY   /* soft-dirty bits in /proc/self/pagemap */
+} MmmDamageTracking;
+
+/* the page aligned span of memory holding the pixels */
+static void
+mmm_track_span (Mmm *fb, uintptr_t *start, uintptr_t *end)
+{
+  uintptr_t page = sysconf (_SC_PAGESIZE);
+
+  *start = (uintptr_t)fb->fb & ~(page - 1);
+  *end = ((uintptr_t)fb->fb + fb->stride * fb->height + page - 1) & ~(page - 1);
+}
+
+static void
+mmm_clear_soft_dirty (void)
+{
+  int fd = open ("/proc/self/clear_refs", O_WRONLY | O_CLOEXEC);
+  if (fd >= 0)
+  {
+    if (write (fd, "4", 1) != 1)
+      {}
+    close (fd);
+  }
+}
+
+/* start tracking writes to the pixels, when they have been (re)mapped */
+static void
+mmm_track_start (Mmm *fb)
+{
+  uintptr_t start, end;
+
+  mmm_track_span (fb, &start, &end);
+  fb->tracked_shm = fb->shm;
+  fb->tracked_size = fb->mapped_size;
+  fb->tracked_fb = fb->fb;
+  fb->tracked_bytes = fb->stride * fb->height;
+  fb->tracked = 0;
+
+#ifdef UFFDIO_API
+  if (fb->auto_damage == MMM_TRACK_UFFD)
+  {
+    struct uffdio_register reg = {{start, end - start},
+                                  UFFDIO_REGISTER_MODE_WP, 0};
+    struct uffdio_writeprotect wp = {{start, end - start},
+                                     UFFDIO_WRITEPROTECT_MODE_WP};
+
+    if (fb->uffd < 0)
+    {
+      struct uffdio_api api = {UFFD_API, UFFD_FEATURE_WP_ASYNC |
+                                         UFFD_FEATURE_WP_HUGETLBFS_SHMEM |
+                                         UFFD_FEATURE_WP_UNPOPULATED, 0};
+
+      fb->uffd = syscall (__NR_userfaultfd,
+                          O_CLOEXEC | O_NONBLOCK | UFFD_USER_MODE_ONLY);
+      if (fb->uffd >= 0 && ioctl (fb->uffd, UFFDIO_API, &api) == -1)
+      {
+        close (fb->uffd);
+        fb->uffd = -1;
+      }
+    }
+    if (fb->uffd >= 0 &&
+        ioctl (fb->uffd, UFFDIO_REGISTER, &reg) == 0 &&
+        ioctl (fb->uffd, UFFDIO_WRITEPROTECT, &wp) == 0)
+    {
+      fb->tracked = -1;
+      return;
+    }
+  }
+#endif
+
+  if (fb->auto_damage == MMM_TRACK_SOFT_DIRTY)
+  {
+    volatile uint8_t *probe = (void*)start;
+    uint64_t entry = 0;
+
+    /* kernels without soft-dirty tracking accept the clearing, see that a
+     * write shows up
+     */
+    mmm_clear_soft_dirty ();
+    *probe = *probe;
+    if (pread (fb->pagemap_fd, &entry, sizeof (entry),
+               start / sysconf (_SC_PAGESIZE) * sizeof (entry)) ==
+          sizeof (entry) &&
+        (entry & MMM_PAGEMAP_SOFT_DIRTY))
+    {
+      mmm_clear_soft_dirty ();
+      fb->tracked = -1;
+      return;
+    }
+  }
+
+  fprintf (stderr, "mmm: no way of tracking writes, damage is not detected\n");
+  fb->auto_damage = MMM_TRACK_OFF;
+}
+
+/* grow the damage with the bytes start - end of the pixels */
+static void
+mmm_damage_span (Mmm *fb, int64_t start, int64_t end,
+                 int *x0, int *y0, int *x1, int *y1)
+{
+  int64_t size = (int64_t)fb->stride * fb->height;
+  int row0, row1;
+
+  if (start < 0)   start = 0;
+  if (end > size)  end = size;
+  if (end <= start)
+    return;
+
+  row0 = start / fb->stride;
+  row1 = (end - 1) / fb->stride;
+  if (row0 == row1)
+  {
+    int col0 = (start % fb->stride) / fb->bpp;
+    int col1 = ((end - 1) % fb->stride) / fb->bpp + 1;
+    if (col0 < *x0) *x0 = col0;
+    if (col1 > *x1) *x1 = col1;
+  }
+  else
+  {
+    *x0 = 0;
+    *x1 = fb->width;
+  }
+  if (row0 < *y0)     *y0 = row0;
+  if (row1 + 1 > *y1) *y1 = row1 + 1;
+}
+
+/* the bounds of the pixels written since tracking was last reset, which it
+ * is again - returns 0 if they are not known, as for the first frame after
+ * arming, which might not rewrite what the host has not seen.
+ */
+static int
+mmm_track_damage (Mmm *fb, int *x, int *y, int *width, int *height)
+{
+  uintptr_t start, end;
+  uintptr_t pixels = (uintptr_t)fb->fb;
+  int x0 = fb->width, y0 = fb->height, x1 = 0, y1 = 0;
+  int armed = fb->tracked < 0;
+
+  if (!fb->tracked)
+    return 0;
+  mmm_track_span (fb, &start, &end);
+
+#ifdef UFFDIO_API
+  if (fb->auto_damage == MMM_TRACK_UFFD)
+  {
+    MmmPageRegion regions[64];
+    MmmScanArg scan;
+    int count, i;
+
+    memset (&scan, 0, sizeof (scan));
+    scan.size = sizeof (scan);
+    scan.flags = MMM_PM_SCAN_WP_MATCHING | MMM_PM_SCAN_CHECK_WPASYNC;
+    scan.end = end;
+    scan.vec = (uintptr_t)regions;
+    scan.vec_len = 64;
+    scan.category_mask = MMM_PAGE_IS_WRITTEN;
+    scan.return_mask = MMM_PAGE_IS_WRITTEN;
+
+    /* written pages are reported and protected again, until all are */
+    for (scan.walk_end = start; scan.walk_end < end; )
+    {
+      scan.start = scan.walk_end;
+      count = ioctl (fb->pagemap_fd, MMM_PAGEMAP_SCAN, &scan);
+      if (count < 0)
+      {
+        fb->tracked = 0;
+        return 0;
+      }
+      for (i = 0; i < count; i++)
+        mmm_damage_span (fb, (int64_t)(regions[i].start - pixels),
+                         (int64_t)(regions[i].end - pixels),
+                         &x0, &y0, &x1, &y1);
+      if (count < 64)
+        break;
+    }
+  }
+  else
+#endif
+  {
+    uintptr_t page = sysconf (_SC_PAGESIZE);
+    uint64_t entries[512];
+    uintptr_t at;
+
+    for (at = start; at < end; )
+    {
+      int count = (end - at) / page;
+      int i;
+
+      if (count > 512)
+        count = 512;
+      if (pread (fb->pagemap_fd, entries, count * sizeof (uint64_t),
+                 at / page * sizeof (uint64_t)) !=
+            (ssize_t)(count * sizeof (uint64_t)))
+      {
+        fb->tracked = 0;
+        return 0;
+      }
+      for (i = 0; i < count; i++, at += page)
+        if (entries[i] & MMM_PAGEMAP_SOFT_DIRTY)
+          mmm_damage_span (fb, (int64_t)(at - pixels),
+                           (int64_t)(at + page - pixels),
+                           &x0, &y0, &x1, &y1);
+    }
+    mmm_clear_soft_dirty ();
+  }
+
+  if (armed)
+  {
+    fb->tracked = 1;
+    return 0;
+  }
+  *x = x0;
+  *y = y0;
+  *width = x1 > x0 ? x1 - x0 : 0;
+  *height = y1 > y0 ? y1 - y0 : 0;
+  return 1;
+}
+
+/* the pixels of the client on the display device the host has handed it */
+static uint8_t *
+mmm_scanout_map (Mmm *fb)
+{
+  MmmFb *shm_fb = &fb->shm->fb;
+  int fd;
+
+  if (fb->scanout_map &&
+      (fb->scanout_size != shm_fb->scanout_size ||
+       strncmp (fb->scanout_device, shm_fb->scanout_device,
+                sizeof (fb->scanout_device))))
+  {
+    munmap (fb->scanout_map, fb->scanout_size);
+    fb->scanout_map = NULL;
+  }
+
+  if (!fb->scanout_map)
+  {
+    memcpy (fb->scanout_device, shm_fb->scanout_device,
+            sizeof (fb->scanout_device));
+    fb->scanout_device[sizeof (fb->scanout_device) - 1] = 0;
+    fb->scanout_size = shm_fb->scanout_size;
+
+    fd = open (fb->scanout_device, O_RDWR | O_CLOEXEC);
+    if (fd < 0)
+      return NULL;
+    fb->scanout_map = mmap (NULL, fb->scanout_size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED, fd, 0);
+    close (fd);
+    if (fb->scanout_map == MAP_FAILED)
+    {
+      fb->scanout_map = NULL;
+      return NULL;
+    }
+  }
+
+  if (shm_fb->scanout_offset < 0 ||
+      fb->stride > shm_fb->scanout_stride ||
+      shm_fb->scanout_offset + (int64_t)shm_fb->scanout_stride * fb->height >
+      fb->scanout_size)
+    return NULL;
+  return fb->scanout_map + shm_fb->scanout_offset;
+}
+
 unsigned char *
 mmm_get_buffer_write (Mmm *fb, int *width, int *height, int *stride,
     void *babl_format)
 {
+  int64_t start = mmm_trace_begin ();
   mmm_wait_neutral (fb);
+  mmm_trace_end (start, "wait-buffer", NULL);
 
   // XXX: do a client check size?
   //fprintf (stderr, "[%i]", fb->bpp);
@@ -253,11 +791,98 @@ mmm_get_buffer_write (Mmm *fb, int *width, int *height, int *stride,
   if (width)  *width  = fb->width;
   if (height) *height = fb->height;
   if (stride) *stride = fb->stride;
+  fb->draw_start = mmm_trace_begin ();
+
+  /* the host only changes where we draw while holding the buffer */
+  if (fb->shm->fb.scanout == 1)
+  {
+    uint8_t *pixels = mmm_scanout_map (fb);
+    if (pixels)
+    {
+      if (stride) *stride = fb->shm->fb.scanout_stride;
+      fb->drawing = pixels;
+      fb->drawing_stride = fb->shm->fb.scanout_stride;
+      return pixels;
+    }
+    /* we keep drawing to the shared buffer, which the host reads again */
+    fb->shm->fb.scanout = -1;
+  }
 
   assert (fb->fb);
+  fb->drawing = fb->fb;
+  fb->drawing_stride = fb->stride;
+  if (fb->auto_damage &&
+      (fb->tracked_shm != fb->shm || fb->tracked_size != fb->mapped_size ||
+       fb->tracked_fb != fb->fb ||
+       fb->tracked_bytes != fb->stride * fb->height))
+    mmm_track_start (fb);
   return fb->fb;
 }
 
+void
+mmm_copy_rect (Mmm *fb, int x, int y, int width, int height, int dx, int dy)
+{
+  MmmFb *shm_fb = &fb->shm->fb;
+  uint8_t *pixels = fb->drawing;
+  int stride = fb->drawing_stride;
+  int scan, step;
+
+  if (!pixels)
+    return;
+
+  /* keep both the source and the destination within the buffer */
+  if (x < 0)      { width += x; x = 0; }
+  if (y < 0)      { height += y; y = 0; }
+  if (x + dx < 0) { width += x + dx; x = -dx; }
+  if (y + dy < 0) { height += y + dy; y = -dy; }
+  if (x + width > fb->width)       width = fb->width - x;
+  if (y + height > fb->height)     height = fb->height - y;
+  if (x + dx + width > fb->width)  width = fb->width - x - dx;
+  if (y + dy + height > fb->height) height = fb->height - y - dy;
+  if (width <= 0 || height <= 0 || (dx == 0 && dy == 0))
+    return;
+
+  /* rows are moved starting from the edge moved towards */
+  scan = dy > 0 ? height - 1 : 0;
+  step = dy > 0 ? -1 : 1;
+  for (; scan >= 0 && scan < height; scan += step)
+    memmove (pixels + (y + dy + scan) * stride + (x + dx) * fb->bpp,
+             pixels + (y + scan) * stride + x * fb->bpp,
+             width * fb->bpp);
+
+  /* the host holds on to one copy per frame, which it applies before the
+   * damage - anything else is reported as damage.
+   */
+  if (fb->shm->header.server_version >= MMM_HOST_COPIES &&
+      !shm_fb->copy_width && !shm_fb->damage_width)
+  {
+    shm_fb->copy_x = x;
+    shm_fb->copy_y = y;
+    shm_fb->copy_width = width;
+    shm_fb->copy_height = height;
+    shm_fb->copy_dx = dx;
+    shm_fb->copy_dy = dy;
+  }
+  else
+  {
+    int x0 = x + dx, y0 = y + dy, x1 = x0 + width, y1 = y0 + height;
+
+    if (shm_fb->damage_width)
+    {
+      if (shm_fb->damage_x < x0) x0 = shm_fb->damage_x;
+      if (shm_fb->damage_y < y0) y0 = shm_fb->damage_y;
+      if (shm_fb->damage_x + shm_fb->damage_width > x1)
+        x1 = shm_fb->damage_x + shm_fb->damage_width;
+      if (shm_fb->damage_y + shm_fb->damage_height > y1)
+        y1 = shm_fb->damage_y + shm_fb->damage_height;
+    }
+    shm_fb->damage_x = x0;
+    shm_fb->damage_y = y0;
+    shm_fb->damage_width = x1 - x0;
+    shm_fb->damage_height = y1 - y0;
+  }
+}
+
 static inline void memcpy32_16 (uint8_t *dst, const uint8_t *src, int count)
 {
   while (count--)
@@ -274,23 +899,99 @@ static inline void memcpy32_16 (uint8_t *dst, const uint8_t *src, int count)
 
 void _mmm_get_coords (Mmm *mmm, double *x, double *y);
 
+/* wake the host, unless we have already done so since it last looked at
+ * our damage - the fifo is opened read-write so that a host that has gone
+ * away makes writes fail rather than raise SIGPIPE.
+ */
+static void
+mmm_ring_doorbell (Mmm *fb)
+{
+  int32_t slot = fb->shm->header.doorbell;
+  uint32_t serial = fb->shm->header.doorbell_serial;
+
+  if (slot <= 0 ||
+      __sync_lock_test_and_set (&fb->shm->header.doorbell_rung, 1))
+    return;
+
+  /* the fifo we hold might be of a host that has since been replaced */
+  if (fb->doorbell_fd >= 0 && fb->doorbell_serial != serial)
+  {
+    close (fb->doorbell_fd);
+    fb->doorbell_fd = -1;
+  }
+  if (fb->doorbell_fd < 0)
+  {
+    char path[512];
+    char *dir_end;
+    snprintf (path, sizeof (path) - 16, "%s", fb->path);
+    dir_end = strrchr (path, '/');
+    if (!dir_end)
+      return;
+    strcpy (dir_end, "/.doorbell");
+    fb->doorbell_fd = open (path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fb->doorbell_fd < 0)
+      return;
+    fb->doorbell_serial = serial;
+  }
+  if (write (fb->doorbell_fd, &slot, sizeof (slot)) != sizeof (slot))
+  {
+    /* the host will still find the damage when it next looks */
+  }
+}
+
 void
 mmm_write_done (Mmm *fb, int x, int y, int width, int height)
 {
+  int64_t start;
+  int tracked = fb->auto_damage && fb->drawing == fb->fb;
+
+  mmm_trace_end (fb->draw_start, "draw", NULL);
+  fb->draw_start = 0;
+  fb->drawing = NULL;
+
+  /* find what was written for clients that do not say */
+  if (tracked && width <= 0 && (width || height))
+  {
+    int64_t scan_start = mmm_trace_begin ();
+    if (mmm_track_damage (fb, &x, &y, &width, &height) &&
+        (width == 0 || height == 0))
+      width = height = 0;
+    mmm_trace_end (scan_start, "damage-scan", NULL);
+  }
+  else if (tracked)
+  {
+    int ignored;
+    /* reset, the next frame might not say */
+    mmm_track_damage (fb, &ignored, &ignored, &ignored, &ignored);
+  }
+
   if (width == 0 && height == 0)
     {
       /* nothing written */
       fb->shm->fb.flip_state = MMM_NEUTRAL;
       return;
     }
+  start = mmm_trace_begin ();
   fb->shm->fb.flip_state = MMM_WAIT_FLIP;
 
+  /* tag the frame with the input it is the response to, an earlier tag
+   * not yet picked up by the host is superseded by this frame.
+   */
+  if (fb->input_time)
+  {
+    fb->shm->fb.input_time = fb->input_time;
+    fb->shm->fb.frame_time = mmm_timestamp ();
+    fb->input_time = 0;
+  }
+
   if (width <= 0)
   {
     fb->shm->fb.damage_x = 0;
     fb->shm->fb.damage_y = 0;
     fb->shm->fb.damage_width  = fb->shm->fb.width;
     fb->shm->fb.damage_height = fb->shm->fb.height;
+    /* all of it is read again, no need to move anything first */
+    fb->shm->fb.copy_width = 0;
   }
   else
   {
@@ -326,6 +1027,8 @@ mmm_write_done (Mmm *fb, int x, int y, int width, int height)
     }
   }
   fb->shm->fb.flip_state = MMM_WAIT_FLIP;
+  mmm_ring_doorbell (fb);
+  mmm_trace_end (start, "write-done", NULL);
 }
 
 int
@@ -350,12 +1053,18 @@ mmm_wait_neutral_or_wait_flip (Mmm *fb)
 const unsigned char *
 mmm_get_buffer_read (Mmm *fb, int *width, int *height, int *stride)
 {
+  int64_t start;
+  int waited;
+
   if (width)  *width  = fb->width;
   if (height) *height = fb->height;
 
   if(mmm_host_check_size (fb, NULL, NULL))
     return NULL;
-  if (mmm_wait_neutral_or_wait_flip (fb))
+  start = mmm_trace_begin ();
+  waited = mmm_wait_neutral_or_wait_flip (fb);
+  mmm_trace_end (start, "wait-client", NULL);
+  if (waited)
     return NULL;
 
   if (stride) *stride = fb->stride;
@@ -365,6 +1074,25 @@ mmm_get_buffer_read (Mmm *fb, int *width, int *height, int *stride)
   return (void*)fb->fb; 
 }
 
+const unsigned char *
+mmm_get_buffer_read_nowait (Mmm *fb, int *width, int *height, int *stride)
+{
+  volatile int32_t *state = &fb->shm->fb.flip_state;
+
+  if (!__sync_bool_compare_and_swap (state, MMM_WAIT_FLIP, MMM_FLIPPING) &&
+      !__sync_bool_compare_and_swap (state, MMM_NEUTRAL, MMM_FLIPPING))
+    return NULL;
+
+  /* the client cannot start a resize while we hold the buffer */
+  mmm_host_check_size (fb, NULL, NULL);
+
+  if (width)  *width  = fb->width;
+  if (height) *height = fb->height;
+  if (stride) *stride = fb->stride;
+
+  return (void*)fb->fb;
+}
+
 void
 mmm_read_done (Mmm *fb)
 {
@@ -372,15 +1100,49 @@ mmm_read_done (Mmm *fb)
   fb->shm->fb.damage_y = 0;
   fb->shm->fb.damage_width = 0;
   fb->shm->fb.damage_height = 0;
+  fb->shm->fb.copy_width = 0;
   fb->shm->fb.flip_state = MMM_NEUTRAL;
 }
 
+int
+mmm_get_copy (Mmm *fb, MmmRectangle *rect, int *dx, int *dy)
+{
+  MmmFb *shm_fb = &fb->shm->fb;
+
+  if (shm_fb->copy_width <= 0 || shm_fb->copy_height <= 0)
+    return 0;
+  if (rect)
+  {
+    rect->x = shm_fb->copy_x;
+    rect->y = shm_fb->copy_y;
+    rect->width = shm_fb->copy_width;
+    rect->height = shm_fb->copy_height;
+  }
+  if (dx) *dx = shm_fb->copy_dx;
+  if (dy) *dy = shm_fb->copy_dy;
+  return 1;
+}
+
+int
+mmm_get_frame_input (Mmm *fb, int64_t *input_time, int64_t *frame_time)
+{
+  if (!fb->shm->fb.input_time)
+    return 0;
+  if (input_time) *input_time = fb->shm->fb.input_time;
+  if (frame_time) *frame_time = fb->shm->fb.frame_time;
+  fb->shm->fb.input_time = 0;
+  fb->shm->fb.frame_time = 0;
+  return 1;
+}
+
 
 Mmm *
 mmm_client_reopen (const char *path)
 {
   Mmm *fb = calloc (sizeof (Mmm), 1);
 
+  fb->doorbell_fd = -1;
+  fb->uffd = fb->pagemap_fd = -1;
   fb->fd = open (path, O_RDWR);
   if (fb->fd == -1)
     {
@@ -405,7 +1167,8 @@ Mmm *
 mmm_host_open (const char *path)
 {
   Mmm *fb = mmm_client_reopen (path);
-  fb->compositor_side = 1;
+  if (fb)
+    fb->compositor_side = 1;
   return fb;
 }
 
@@ -519,8 +1282,14 @@ int mmm_has_event (Mmm *fb)
 }
 
 void mmm_add_event (Mmm *fb, const char *event)
+{
+  mmm_add_event_at (fb, event, 0);
+}
+
+void mmm_add_event_at (Mmm *fb, const char *event, int64_t time)
 {
   MmmShm *shm = fb->shm;
+  uint8_t *slot;
   int event_no = shm->events.write + 1;
   if (event_no >= MMM_MAX_EVENT)
     event_no = 0;
@@ -534,7 +1303,13 @@ void mmm_add_event (Mmm *fb, const char *event)
       return;
     }
 
-  strcpy ((void*)shm->events.buffer[event_no], event);
+  if (!time)
+    time = mmm_timestamp ();
+  slot = shm->events.buffer[event_no];
+  strncpy ((void*)slot, event, MMM_EVENT_TIME_OFFSET - 1);
+  slot[MMM_EVENT_TIME_OFFSET - 1] = 0;
+  memcpy (slot + MMM_EVENT_TIME_OFFSET, &time, sizeof (time));
+  mmm_trace_mark ("event-queued", event);
 
   shm->events.write ++;
   if (shm->events.write >= MMM_MAX_EVENT)
@@ -543,16 +1318,28 @@ void mmm_add_event (Mmm *fb, const char *event)
 
 const char *mmm_get_event (Mmm *fb)
 {
+  uint8_t *slot;
   if (fb->shm->events.read != fb->shm->events.write)
     {
       fb->shm->events.read++;
       if (fb->shm->events.read >= MMM_MAX_EVENT)
         fb->shm->events.read = 0;
-      return (void*)fb->shm->events.buffer[fb->shm->events.read];
+      slot = fb->shm->events.buffer[fb->shm->events.read];
+      memcpy (&fb->event_time, slot + MMM_EVENT_TIME_OFFSET,
+              sizeof (fb->event_time));
+      if (fb->event_time > fb->input_time)
+        fb->input_time = fb->event_time;
+      mmm_trace_mark ("event-read", (void*)slot);
+      return (void*)slot;
     }
   return NULL;
 }
 
+int64_t mmm_get_event_time (Mmm *fb)
+{
+  return fb->event_time;
+}
+
 static Mmm *mmm_new_shm (const char *mmm_path, int width, int height, void *babl_format);
 
 Mmm *mmm_new (int width, int height, MmmFlag flags, void *babl_format)
@@ -611,6 +1398,17 @@ Mmm *mmm_new (int width, int height, MmmFlag flags, void *babl_format)
     fprintf (stderr, "failed to initialize framebuffer\n");
     exit (-1);
   }
+
+  if ((flags & MMM_FLAG_AUTO_DAMAGE) ||
+      (getenv ("MMM_AUTO_DAMAGE") && strcmp (getenv ("MMM_AUTO_DAMAGE"), "0")))
+  {
+    const char *method = getenv ("MMM_AUTO_DAMAGE");
+    fb->pagemap_fd = open ("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+    /* soft-dirty bits are reset for the whole process, only when asked */
+    if (fb->pagemap_fd >= 0)
+      fb->auto_damage = method && !strcmp (method, "soft-dirty") ?
+                        MMM_TRACK_SOFT_DIRTY : MMM_TRACK_UFFD;
+  }
   if (width < 0 || height < 0)
   {
     int waits = 0;
@@ -650,6 +1448,7 @@ static void mmm_init_header (MmmShm *shm)
   int length;
 
   shm->fb.fb_offset = sizeof (MmmShm);
+  shm->header.client_version = MMM_CLIENT_VERSION;
   length = sizeof (MmmHeader);
   shm->header.block.length = length;
   pos += length;
@@ -708,6 +1507,8 @@ static Mmm *mmm_new_shm (const char *mmm_path, int width, int height, void *babl
     }
 
   fb->format = babl_format;
+  fb->doorbell_fd = -1;
+  fb->uffd = fb->pagemap_fd = -1;
   fb->width  = width;
   fb->height = height;
   fb->bpp = 4;
@@ -723,8 +1524,6 @@ static Mmm *mmm_new_shm (const char *mmm_path, int width, int height, void *babl
   pwrite (fb->fd, "", 1, sizeof (MmmShm) + fb->stride * fb->height);
   fsync (fb->fd);
 
-  chmod (fb->path, 511);
-
   fb->mapped_size = fb->stride * fb->height + sizeof (MmmShm);
   fb->shm = mmap (NULL, fb->mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED, fb->fd, 0);
   mmm_init_header (fb->shm);
@@ -738,6 +1537,9 @@ static Mmm *mmm_new_shm (const char *mmm_path, int width, int height, void *babl
   fb->shm->header.pid        = getpid ();
   mmm_remap (fb);
 
+  /* done after the header is valid, hosts watch for this attribute change */
+  chmod (fb->path, 511);
+
   /* do a lookup, or make it even happen on-demand? */
   fb->pcm = &fb->shm->pcm;
   fb->events = &fb->shm->events;
@@ -756,11 +1558,67 @@ mmm_destroy (Mmm *fb)
     system (buf);
   }
   munmap (fb->shm, fb->mapped_size);
+  if (fb->scanout_map)
+    munmap (fb->scanout_map, fb->scanout_size);
   if (fb->fd)
     close (fb->fd);
+  if (fb->doorbell_fd >= 0)
+    close (fb->doorbell_fd);
+  if (fb->uffd >= 0)
+    close (fb->uffd);
+  if (fb->pagemap_fd >= 0)
+    close (fb->pagemap_fd);
   free (fb);
 }
 
+int mmm_host_set_doorbell (Mmm *fb, int slot)
+{
+  if (fb->shm->header.client_version < 1)
+    return 0;
+  fb->shm->header.doorbell = slot;
+  fb->shm->header.doorbell_serial++;
+  return 1;
+}
+
+int mmm_host_set_scanout (Mmm *fb, const char *device, int64_t offset,
+                          int stride, int64_t size)
+{
+  MmmFb *shm_fb = &fb->shm->fb;
+
+  if (fb->shm->header.client_version < 2)
+    return 0;
+  if (!device)
+  {
+    shm_fb->scanout = 0;
+    return 1;
+  }
+  strncpy (shm_fb->scanout_device, device, sizeof (shm_fb->scanout_device) - 1);
+  shm_fb->scanout_device[sizeof (shm_fb->scanout_device) - 1] = 0;
+  shm_fb->scanout_offset = offset;
+  shm_fb->scanout_stride = stride;
+  shm_fb->scanout_size = size;
+  __sync_synchronize ();
+  shm_fb->scanout = 1;
+  return 1;
+}
+
+int mmm_host_get_scanout (Mmm *fb)
+{
+  return fb->shm->fb.scanout;
+}
+
+void mmm_host_accept_copies (Mmm *fb)
+{
+  if (fb->shm->header.server_version < MMM_HOST_COPIES)
+    fb->shm->header.server_version = MMM_HOST_COPIES;
+}
+
+void mmm_host_doorbell_ack (Mmm *fb)
+{
+  __sync_lock_release (&fb->shm->header.doorbell_rung);
+  __sync_synchronize ();
+}
+
 int mmm_get_damage (Mmm *fb, int *x, int *y, int *width, int *height)
 {
   if (x)
@@ -1154,6 +2012,16 @@ void mmm_add_message (Mmm *fb, const char *message)
     shm->messages.write = 0;
 }
 
+const char *mmm_peek_message (Mmm *fb)
+{
+  int message_no = fb->shm->messages.read + 1;
+  if (fb->shm->messages.read == fb->shm->messages.write)
+    return NULL;
+  if (message_no >= MMM_MAX_EVENT)
+    message_no = 0;
+  return (void*)fb->shm->messages.buffer[message_no];
+}
+
 const char *mmm_get_message (Mmm *fb)
 {
   if (fb->shm->messages.read != fb->shm->messages.write)
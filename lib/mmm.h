@@ -30,7 +30,14 @@ struct _MmmRectangle {
 
 typedef enum {
   MMM_FLAG_DEFAULT = 0,
-  MMM_FLAG_BUFFER  = 1 << 0  /* hint that we want an extra double buffering layer */
+  MMM_FLAG_BUFFER  = 1 << 0, /* hint that we want an extra double buffering layer */
+  MMM_FLAG_AUTO_DAMAGE = 1 << 1 /* find the damage of frames committed with
+                                   -1, -1 from the pages written, also
+                                   enabled with MMM_AUTO_DAMAGE=1, or with
+                                   MMM_AUTO_DAMAGE=soft-dirty on kernels
+                                   without userfaultfd write protection -
+                                   at the cost of resetting the soft-dirty
+                                   bits of the whole process each frame */
 } MmmFlag;
 
 /* create a new framebuffer client, passing in -1, -1 tries to request
@@ -76,6 +83,9 @@ const char *   mmm_get_title            (Mmm *fb);
 /* these with a key of "title" should replace the title
  * and be used with "clipboard" for clipboard, hosts can recognize the
  * existance of the "clipboard" key and enable clipboard handling.
+ *
+ * Clients are composited as opaque, setting "alpha" to "1" makes the host
+ * treat the pixels as premultiplied and blend them over what is beneath.
  */
 void           mmm_set_value            (Mmm *fb, const char *key, const char *value);
 const char *   mmm_get_value            (Mmm *fb, const char *key);
@@ -134,17 +144,39 @@ unsigned char *mmm_get_buffer_write (Mmm *fb,
  * bounding box of the changed region - as eink devices, serial protocol
  * framebuffers and compositing window managers want to know this information
  * to do efficient updates. width/height of -1, -1 reports that any pixel in
- * the buffer might have changed.
+ * the buffer might have changed - with MMM_FLAG_AUTO_DAMAGE the bounds of
+ * the memory pages written since the last frame are reported instead.
  */
 void           mmm_write_done       (Mmm *fb,
                                      int damage_x, int damage_y,
                                      int damage_width, int damage_height);
 
+/* mmm_copy_rect:
+ * @fb: an mmm between mmm_get_buffer_write and mmm_write_done
+ * @x, @y, @width, @height: the pixels to move
+ * @dx, @dy: how far to move them
+ *
+ * Moves pixels within the buffer, for scrolling - call it before drawing
+ * anything else in the frame. Hosts that can do the same with what they
+ * have shown do not need the moved pixels reported as damage, only what
+ * is exposed and drawn afresh.
+ */
+void           mmm_copy_rect        (Mmm *fb,
+                                     int x, int y, int width, int height,
+                                     int dx, int dy);
+
 /* event queue:  */
 int            mmm_has_event        (Mmm *fb);
 const char    *mmm_get_event        (Mmm *fb);
-/* host-side - for queuing the events */
+/* when the input behind the last event returned by mmm_get_event happened,
+ * in mmm_timestamp () microseconds. The newest such time read is attached
+ * to the next frame committed with mmm_write_done, for latency tracing.
+ */
+int64_t        mmm_get_event_time   (Mmm *fb);
+/* host-side - for queuing the events, events are truncated to 119 chars */
 void           mmm_add_event        (Mmm *fb, const char *event);
+/* as mmm_add_event, with the time the input happened, 0 for now */
+void           mmm_add_event_at     (Mmm *fb, const char *event, int64_t time);
 
 /* warp the _mouse_ cursor to given coordinates; doesn't do much on a
  * touch-screen
@@ -155,12 +187,36 @@ void           mmm_warp_cursor      (Mmm *fb, int x, int y);
  */
 long           mmm_ticks       (void);
 
+/* wall clock time in microseconds, comparable between processes and with
+ * the timestamps of kernel input events.
+ */
+int64_t        mmm_timestamp   (void);
+
+/* protocol tracing: with MMM_TRACE set to a file name, the latest spans of
+ * the library and host are appended to that file at exit as Chrome
+ * trace-event JSON - client and host processes end up on one timeline,
+ * viewable in chrome://tracing or ui.perfetto.dev.
+ *
+ * mmm_trace_begin returns the start of a span, 0 when tracing is off, to be
+ * passed to mmm_trace_end; names must remain valid until exit, arg is
+ * copied (truncated to 27 chars) and can be NULL.
+ */
+int64_t        mmm_trace_begin (void);
+void           mmm_trace_end   (int64_t start, const char *name,
+                                const char *arg);
+/* an instant */
+void           mmm_trace_mark  (const char *name, const char *arg);
+
 /* message queue:
  *   messages that some hosts accepts:
+ *     "hud" - toggles the statistics HUD of the fbdev and kobo hosts, which
+ *             take it off the queue, leaving other messages in place
  */
 void           mmm_add_message      (Mmm *fb, const char *message);
 int            mmm_has_message      (Mmm *fb);
 const char    *mmm_get_message      (Mmm *fb);
+/* the message mmm_get_message would return, without taking it */
+const char    *mmm_peek_message     (Mmm *fb);
 
 
 /*** audio ***/
@@ -234,9 +290,22 @@ const unsigned char *mmm_get_buffer_read (Mmm *fb,
                                           int *width, int *height,
                                           int *stride);
 
+/* like mmm_get_buffer_read, but returns NULL at once when the client is
+ * busy drawing, rather than waiting for it to finish.
+ */
+const unsigned char *mmm_get_buffer_read_nowait (Mmm *fb,
+                                                 int *width, int *height,
+                                                 int *stride);
+
 /* this clears accumulated damage.  */
 void           mmm_read_done        (Mmm *fb);
 
+/* if the frame read was tagged as the response to input, gets when the
+ * input happened and when the frame was committed, and clears the tag.
+ */
+int            mmm_get_frame_input  (Mmm *fb, int64_t *input_time,
+                                     int64_t *frame_time);
+
 /* open up a buffer - as held by a client */
 Mmm           *mmm_host_open        (const char *path);
 
@@ -253,5 +322,38 @@ void           mmm_host_set_size (Mmm *fb, int width, int height);
 
 long           mmm_client_pid  (Mmm *fb);
 
+/* assign a client the slot it writes to the .doorbell fifo next to its
+ * buffer when it has new damage, returns 0 if the client is too old to do
+ * so and has to be polled.
+ */
+int            mmm_host_set_doorbell (Mmm *fb, int slot);
+
+/* re-arm the doorbell of a client, call before checking it for damage */
+void           mmm_host_doorbell_ack (Mmm *fb);
+
+/* tell a client the host applies the copies of mmm_copy_rect, rather than
+ * getting them as damage
+ */
+void           mmm_host_accept_copies (Mmm *fb);
+
+/* the copy the client made before drawing the damage of the frame being
+ * read, to be applied first; returns 0 if there was none.
+ */
+int            mmm_get_copy         (Mmm *fb, MmmRectangle *rect,
+                                     int *dx, int *dy);
+
+/* have a client draw straight to a display device, mapping size bytes of
+ * it and drawing its pixels at offset with rows stride bytes apart - or
+ * back to its own buffer with a NULL device. Only change this while
+ * holding the buffer for reading, returns 0 if the client is too old.
+ */
+int            mmm_host_set_scanout (Mmm *fb, const char *device,
+                                     int64_t offset, int stride, int64_t size);
+
+/* 1 while the client draws to the device, 0 when not and -1 if it failed
+ * to and draws to its own buffer instead
+ */
+int            mmm_host_get_scanout (Mmm *fb);
+
 
 #endif